@@ -0,0 +1,202 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ACCESSLOG_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ACCESSLOG_H
+
+#include "Metrics.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Structured access log, one logfmt line per RPC. Recording copies a fixed-size record into the
+// calling thread's own ring buffer, which is single-producer/single-consumer and needs no lock; a
+// background thread drains all rings in batches, formats the lines and writes them with one call.
+// When a ring is full the record is dropped and counted rather than making the caller wait.
+// Records are only kept while an AccessLog object exists.
+class AccessLog {
+public:
+    // Takes over `out` and closes it when destroyed, unless it is stdout or stderr.
+    explicit AccessLog(FILE *out, std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+            : out(out), interval(interval), writer([this] { loop(); }) {
+        active().store(true, std::memory_order_release);
+    }
+
+    AccessLog(const AccessLog &) = delete;
+
+    ~AccessLog() {
+        active().store(false, std::memory_order_release);
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+        if (out != stdout && out != stderr) {
+            std::fclose(out);
+        }
+    }
+
+    static void record(std::string_view rpc, std::string_view user, std::chrono::nanoseconds latency,
+                       std::string_view outcome) {
+        static const auto dropped = Metrics::counter("gdms_access_log_dropped_total",
+                                                     "Access log records dropped because a ring buffer was full.");
+        if (!active().load(std::memory_order_acquire)) {
+            return;
+        }
+        Ring &r = ring();
+        uint64_t head = r.head.load(std::memory_order_relaxed);
+        if (head - r.tail.load(std::memory_order_acquire) == RING_SIZE) {
+            Metrics::increment(dropped);
+            return;
+        }
+        Record &slot = r.slots[head % RING_SIZE];
+        slot.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        slot.latency = std::max<int64_t>(latency.count(), 0);
+        copy(slot.rpc, rpc);
+        copy(slot.user, user);
+        copy(slot.outcome, outcome);
+        r.head.store(head + 1, std::memory_order_release);
+    }
+
+private:
+    static constexpr size_t RING_SIZE = 2048;
+
+    // Longer strings are truncated.
+    struct Record {
+        int64_t time;     // ns since the epoch
+        uint64_t latency; // ns
+        char rpc[32];
+        char user[48];
+        char outcome[72];
+    };
+
+    struct Ring {
+        std::array<Record, RING_SIZE> slots;
+        alignas(64) std::atomic<uint64_t> head{0}; // next slot to fill, owned by the producer
+        alignas(64) std::atomic<uint64_t> tail{0}; // next slot to drain, owned by the writer
+    };
+
+    // Rings outlive their threads, so records of a thread that exits are still written.
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Ring>> rings;
+    };
+
+    static std::atomic<bool> &active() {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+
+    static Registry &registry() {
+        static Registry r;
+        return r;
+    }
+
+    static Ring &ring() {
+        thread_local Ring *r = [] {
+            auto &reg = registry();
+            std::lock_guard lock(reg.mutex);
+            reg.rings.push_back(std::make_unique<Ring>());
+            return reg.rings.back().get();
+        }();
+        return *r;
+    }
+
+    template<size_t N>
+    static void copy(char (&to)[N], std::string_view from) {
+        size_t n = std::min(from.size(), N - 1);
+        from.copy(to, n);
+        to[n] = '\0';
+    }
+
+    void loop() {
+        std::unique_lock lock(mutex);
+        while (!stopping) {
+            wake.wait_for(lock, interval, [this] { return stopping; });
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+    void drain() {
+        std::vector<Ring *> rings;
+        {
+            auto &reg = registry();
+            std::lock_guard lock(reg.mutex);
+            for (const auto &r: reg.rings) {
+                rings.push_back(r.get());
+            }
+        }
+        std::string batch;
+        for (Ring *r: rings) {
+            uint64_t tail = r->tail.load(std::memory_order_relaxed);
+            uint64_t head = r->head.load(std::memory_order_acquire);
+            for (; tail != head; ++tail) {
+                format(batch, r->slots[tail % RING_SIZE]);
+            }
+            r->tail.store(tail, std::memory_order_release);
+        }
+        if (!batch.empty()) {
+            std::fwrite(batch.data(), 1, batch.size(), out);
+            std::fflush(out);
+        }
+    }
+
+    static void format(std::string &line, const Record &r) {
+        std::time_t seconds = r.time / 1000000000;
+        std::tm utc{};
+        gmtime_r(&seconds, &utc);
+        char buf[64];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &utc);
+        line += "ts=";
+        line += buf;
+        std::snprintf(buf, sizeof(buf), ".%06ldZ rpc=", static_cast<long>(r.time % 1000000000 / 1000));
+        line += buf;
+        value(line, r.rpc);
+        line += " user=";
+        value(line, r.user);
+        std::snprintf(buf, sizeof(buf), " latency_us=%lu outcome=", static_cast<unsigned long>(r.latency / 1000));
+        line += buf;
+        value(line, r.outcome);
+        line += '\n';
+    }
+
+    // Quotes values that are empty or contain spaces, quotes or control characters.
+    static void value(std::string &line, std::string_view v) {
+        bool plain = !v.empty() && std::none_of(v.begin(), v.end(), [](char c) {
+            return c == ' ' || c == '"' || c == '=' || static_cast<unsigned char>(c) < 0x20;
+        });
+        if (plain) {
+            line += v;
+            return;
+        }
+        line += '"';
+        for (char c: v) {
+            if (c == '"' || c == '\\') {
+                line += '\\';
+            }
+            line += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+        }
+        line += '"';
+    }
+
+    FILE *const out;
+    const std::chrono::milliseconds interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread writer;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ACCESSLOG_H
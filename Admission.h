@@ -0,0 +1,166 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ADMISSION_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ADMISSION_H
+
+#include "Metrics.h"
+#include <capnp/capability.h>
+#include <capnp/schema.h>
+#include <kj/async.h>
+#include <kj/debug.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Admission control for expensive RPCs, shared by all event-loop threads. Methods are sorted into
+// groups, each with a cap on calls running at once and a bounded FIFO queue of calls waiting for a
+// slot. Once the queue is full further calls fail at once with an OVERLOADED exception, which capnp
+// clients treat as retryable, instead of piling up behind the expensive work. Methods outside every
+// group are never delayed.
+class Admission {
+public:
+    struct Limit {
+        size_t concurrency;
+        size_t queue;
+    };
+
+    explicit Admission(std::vector<std::pair<std::string, Limit>> limits) {
+        for (auto &[name, limit]: limits) {
+            groups.push_back({name, limit});
+        }
+        for (size_t g = 0; g != groups.size(); ++g) {
+            std::string labels = "group=\"" + groups[g].name + "\"";
+            groups[g].rejected = Metrics::counter("gdms_admission_rejected_total",
+                                                  "Calls refused because the admission queue was full.", labels);
+            Metrics::gauge("gdms_admission_running", "Admitted calls running.", [this, g] {
+                std::lock_guard lock(mutex);
+                return static_cast<double>(groups[g].running);
+            }, labels);
+            Metrics::gauge("gdms_admission_queued", "Calls waiting for admission.", [this, g] {
+                std::lock_guard lock(mutex);
+                return static_cast<double>(groups[g].waiting.size());
+            }, labels);
+        }
+    }
+
+    Admission(const Admission &) = delete;
+
+    // Group of every method of `Interface`, by ordinal, or -1 for methods that are not limited.
+    // Groups are numbered in the order they were passed to the constructor.
+    template<typename Interface>
+    static std::vector<int> routes(const std::map<std::string, int> &groupOfMethod) {
+        std::vector<int> out;
+        for (auto method: capnp::Schema::from<Interface>().getMethods()) {
+            auto found = groupOfMethod.find(method.getProto().getName().cStr());
+            out.push_back(found == groupOfMethod.end() ? -1 : found->second);
+        }
+        return out;
+    }
+
+    // Holds a slot of a group; the slot is handed on when the permit is destroyed.
+    class Permit {
+    public:
+        Permit(Admission &admission, int group) : admission(admission), group(group) {}
+
+        Permit(const Permit &) = delete;
+
+        ~Permit() {
+            admission.release(group);
+        }
+
+    private:
+        Admission &admission;
+        const int group;
+    };
+
+    // Resolves to a permit once `group` has a free slot, or fails with OVERLOADED if its queue is full.
+    kj::Promise<kj::Own<Permit>> acquire(int group) {
+        kj::Promise<kj::Own<Permit>> later = nullptr;
+        auto permit = enter(group, later);
+        if (permit != nullptr) {
+            return kj::mv(permit);
+        }
+        return later;
+    }
+
+    // Runs `dispatch()` now if `group` has a free slot, later if the call fits in the queue, and not at
+    // all otherwise. The slot is held until the call completes or is cancelled.
+    template<typename Dispatch>
+    capnp::Capability::Server::DispatchCallResult gate(int group, Dispatch &&dispatch) {
+        if (group < 0) {
+            return dispatch();
+        }
+        kj::Promise<kj::Own<Permit>> later = nullptr;
+        auto permit = enter(group, later);
+        if (permit != nullptr) {
+            auto result = dispatch();
+            result.promise = result.promise.attach(kj::mv(permit));
+            return result;
+        }
+        // Only non-streaming methods are gated, so the result can be built before dispatching.
+        return {later.then([dispatch = kj::fwd<Dispatch>(dispatch)](kj::Own<Permit> permit) mutable {
+            return dispatch().promise.attach(kj::mv(permit));
+        }), false};
+    }
+
+private:
+    struct Group {
+        std::string name;
+        Limit limit;
+        size_t running = 0;
+        std::deque<kj::Own<kj::CrossThreadPromiseFulfiller<kj::Own<Permit>>>> waiting;
+        Metrics::Id rejected = 0;
+    };
+
+    // Takes a free slot and returns its permit, or sets `later` to a queued or rejected promise. The
+    // caller runs its work outside the lock, since its synchronous part may be slow.
+    kj::Own<Permit> enter(int group, kj::Promise<kj::Own<Permit>> &later) {
+        auto &g = groups[group];
+        {
+            std::lock_guard lock(mutex);
+            if (g.running < g.limit.concurrency) {
+                ++g.running;
+                return kj::heap<Permit>(*this, group);
+            }
+            while (!g.waiting.empty() && !g.waiting.front()->isWaiting()) {
+                g.waiting.pop_front();
+            }
+            if (g.waiting.size() < g.limit.queue) {
+                auto paf = kj::newPromiseAndCrossThreadFulfiller<kj::Own<Permit>>();
+                g.waiting.push_back(kj::mv(paf.fulfiller));
+                later = kj::mv(paf.promise);
+                return nullptr;
+            }
+        }
+        // Recorded outside the lock: the gauges read under it while the metrics registry is locked.
+        Metrics::increment(g.rejected);
+        later = KJ_EXCEPTION(OVERLOADED, "server busy, retry later", g.name);
+        return nullptr;
+    }
+
+    // Hands the slot to the oldest caller still waiting, or frees it. The hand-over happens outside
+    // the lock: if that caller has gone meanwhile, its permit is dropped and released again.
+    void release(int group) {
+        kj::Own<kj::CrossThreadPromiseFulfiller<kj::Own<Permit>>> next;
+        {
+            std::lock_guard lock(mutex);
+            auto &g = groups[group];
+            while (!g.waiting.empty() && !next) {
+                if (g.waiting.front()->isWaiting()) {
+                    next = kj::mv(g.waiting.front());
+                }
+                g.waiting.pop_front();
+            }
+            if (!next) {
+                --g.running;
+                return;
+            }
+        }
+        next->fulfill(kj::heap<Permit>(*this, group));
+    }
+
+    std::mutex mutex;
+    std::vector<Group> groups;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ADMISSION_H
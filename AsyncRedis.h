@@ -0,0 +1,184 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ASYNCREDIS_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ASYNCREDIS_H
+
+#include "Metrics.h"
+#include <hiredis/hiredis.h>
+#include <kj/async-io.h>
+#include <kj/debug.h>
+#include <deque>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct RedisReply {
+    int type = REDIS_REPLY_NIL;
+    long long integer = 0;
+    std::string str;
+    std::vector<RedisReply> elements;
+
+    bool isNil() const {
+        return type == REDIS_REPLY_NIL;
+    }
+};
+
+// Redis client driven by the kj event loop. Replies resolve promises instead of blocking the thread.
+// Commands issued during one turn of the loop are written out together and their replies come back in
+// order, so a handler that fires several commands at once pays a single round trip.
+// Only usable from the thread that created it.
+class AsyncRedis {
+public:
+    AsyncRedis(kj::Network &network, std::string host, unsigned port)
+            : network(network), host(std::move(host)), port(port) {}
+
+    kj::Promise<RedisReply> command(std::initializer_list<std::string_view> args) {
+        return command(kj::arrayPtr(args.begin(), args.size()));
+    }
+
+    // For commands whose arity is only known at run time, such as SADD with many members.
+    kj::Promise<RedisReply> command(kj::ArrayPtr<const std::string_view> args) {
+        KJ_REQUIRE(args.size() > 0, "empty redis command");
+        if (!connection || connection->broken) {
+            connection = kj::heap<Connection>(
+                    network.parseAddress(host.c_str(), port).then([](kj::Own<kj::NetworkAddress> addr) {
+                        return addr->connect().attach(kj::mv(addr));
+                    }));
+        }
+        return Metrics::timed(timerFor(*args.begin()), connection->send(args));
+    }
+
+private:
+    // One latency series per command name, looked up without touching the shared registry.
+    Metrics::Id timerFor(std::string_view name) {
+        auto it = timers.find(name);
+        if (it == timers.end()) {
+            auto id = Metrics::timer("gdms_redis_command_seconds", "Redis round trip per command.",
+                                     "command=\"" + std::string(name) + "\"");
+            it = timers.emplace(std::string(name), id).first;
+        }
+        return it->second;
+    }
+
+    class Connection final : public kj::TaskSet::ErrorHandler {
+    public:
+        bool broken = false;
+
+        explicit Connection(kj::Promise<kj::Own<kj::AsyncIoStream>> connecting)
+                : reader(redisReaderCreate()),
+                  ready(connecting.then([this](kj::Own<kj::AsyncIoStream> s) {
+                      stream = kj::mv(s);
+                      tasks.add(readLoop());
+                  }).fork()),
+                  tasks(*this) {}
+
+        ~Connection() noexcept(false) {
+            redisReaderFree(reader);
+        }
+
+        kj::Promise<RedisReply> send(kj::ArrayPtr<const std::string_view> args) {
+            outgoing += '*';
+            outgoing += std::to_string(args.size());
+            outgoing += "\r\n";
+            for (auto arg: args) {
+                outgoing += '$';
+                outgoing += std::to_string(arg.size());
+                outgoing += "\r\n";
+                outgoing += arg;
+                outgoing += "\r\n";
+            }
+            auto paf = kj::newPromiseAndFulfiller<RedisReply>();
+            pending.push_back(kj::mv(paf.fulfiller));
+            if (!flushScheduled) {
+                flushScheduled = true;
+                tasks.add(kj::evalLater([this] { return flush(); }));
+            }
+            return kj::mv(paf.promise);
+        }
+
+        void taskFailed(kj::Exception &&exception) override {
+            broken = true;
+            for (auto &f: pending) {
+                f->reject(kj::cp(exception));
+            }
+            pending.clear();
+        }
+
+    private:
+        kj::Promise<void> flush() {
+            flushScheduled = false;
+            if (writing || outgoing.empty()) {
+                return kj::READY_NOW;
+            }
+            writing = true;
+            return ready.addBranch().then([this] {
+                auto data = kj::heap<std::string>();
+                data->swap(outgoing);
+                auto write = stream->write(data->data(), data->size());
+                return write.attach(kj::mv(data));
+            }).then([this] {
+                writing = false;
+                return flush();
+            });
+        }
+
+        kj::Promise<void> readLoop() {
+            return stream->tryRead(buffer, 1, sizeof(buffer)).then([this](size_t n) -> kj::Promise<void> {
+                if (n == 0) {
+                    return KJ_EXCEPTION(DISCONNECTED, "redis closed the connection");
+                }
+                KJ_REQUIRE(redisReaderFeed(reader, buffer, n) == REDIS_OK, "malformed redis reply");
+                void *raw = nullptr;
+                while (true) {
+                    KJ_REQUIRE(redisReaderGetReply(reader, &raw) == REDIS_OK, "malformed redis reply");
+                    if (!raw) {
+                        break;
+                    }
+                    RedisReply reply = convert(static_cast<redisReply *>(raw));
+                    freeReplyObject(raw);
+                    KJ_REQUIRE(!pending.empty(), "unexpected redis reply");
+                    auto fulfiller = kj::mv(pending.front());
+                    pending.pop_front();
+                    if (reply.type == REDIS_REPLY_ERROR) {
+                        fulfiller->reject(KJ_EXCEPTION(FAILED, "redis error", reply.str));
+                    } else {
+                        fulfiller->fulfill(kj::mv(reply));
+                    }
+                }
+                return readLoop();
+            });
+        }
+
+        static RedisReply convert(const redisReply *r) {
+            RedisReply out;
+            out.type = r->type;
+            out.integer = r->integer;
+            if (r->str) {
+                out.str.assign(r->str, r->len);
+            }
+            out.elements.reserve(r->elements);
+            for (size_t i = 0; i != r->elements; ++i) {
+                out.elements.push_back(convert(r->element[i]));
+            }
+            return out;
+        }
+
+        redisReader *reader;
+        kj::Own<kj::AsyncIoStream> stream;
+        kj::ForkedPromise<void> ready;
+        std::string outgoing;
+        std::deque<kj::Own<kj::PromiseFulfiller<RedisReply>>> pending;
+        bool flushScheduled = false;
+        bool writing = false;
+        char buffer[16384];
+        kj::TaskSet tasks;
+    };
+
+    kj::Network &network;
+    std::string host;
+    unsigned port;
+    kj::Own<Connection> connection;
+    std::map<std::string, Metrics::Id, std::less<>> timers;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ASYNCREDIS_H
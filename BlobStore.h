@@ -0,0 +1,132 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_BLOBSTORE_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_BLOBSTORE_H
+
+#include "SHA256.h"
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QString>
+#include <QTemporaryFile>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Content-addressed file store. Every distinct file content is kept once, at
+// "<root>/<first two hex digits of its SHA256>/<remaining digits>", and files in the user trees are
+// hard links to those blobs. Storing content that is already present writes nothing, and a tree
+// entry that already links to the right blob is left alone.
+// The root has to be on the same filesystem as the user trees for the links to work; otherwise the
+// blobs are copied.
+class BlobStore {
+public:
+    explicit BlobStore(const QString &root) : root(QDir::cleanPath(root)), tmp(this->root + "/tmp") {
+        QDir().mkpath(tmp);
+    }
+
+    // Receives one file's content and hashes it on the way in. Content is kept in memory up to
+    // MEMORY_LIMIT and spilled into a temporary file beyond that, so nothing hits the disk unless the
+    // blob turns out to be new. Not thread-safe; use one writer per file.
+    class Writer {
+    public:
+        explicit Writer(const BlobStore &store) : store(store) {}
+
+        bool write(const char *data, qint64 n) {
+            sha.update(reinterpret_cast<const uint8_t *>(data), static_cast<size_t>(n));
+            if (!spill && pending.size() + n <= MEMORY_LIMIT) {
+                pending.append(data, static_cast<int>(n));
+                return true;
+            }
+            if (!spill) {
+                spill = std::make_unique<QTemporaryFile>(store.tmp + "/blob-XXXXXX");
+                if (!spill->open() || spill->write(pending) != pending.size()) {
+                    return false;
+                }
+                pending.clear();
+            }
+            return spill->write(data, n) == n;
+        }
+
+        // Stores the content if it is new and makes `target` a link to it. Returns an error message,
+        // or an empty string on success.
+        std::string commit(const QString &target) {
+            auto *digest = sha.digest();
+            std::string hash = SHA256::toString(digest);
+            delete[] digest;
+            QString blob = store.pathOf(hash);
+            if (!QFile::exists(blob)) {
+                QDir().mkpath(QFileInfo(blob).path());
+                if (spill) {
+                    // QFile::rename() does not replace an existing file, so a concurrent upload of the
+                    // same content may have stored the blob between the check above and here.
+                    if (!spill->flush() || (!spill->rename(blob) && !QFile::exists(blob))) {
+                        return "cannot store blob";
+                    }
+                } else {
+                    QSaveFile out(blob);
+                    if (!out.open(QIODevice::WriteOnly) || out.write(pending) != pending.size() || !out.commit()) {
+                        return "cannot store blob";
+                    }
+                }
+            }
+            return store.link(hash, target);
+        }
+
+    private:
+        const BlobStore &store;
+        SHA256 sha;
+        QByteArray pending;
+        std::unique_ptr<QTemporaryFile> spill;
+    };
+
+    Writer writer() const {
+        return Writer(*this);
+    }
+
+    // Whether `hash` looks like a hex SHA256 digest as produced by the writer.
+    static bool isHash(const std::string &hash) {
+        return hash.size() == 64 && std::all_of(hash.begin(), hash.end(), [](char c) {
+            return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+        });
+    }
+
+    QString pathOf(const std::string &hash) const {
+        return root + '/' + QString::fromStdString(hash.substr(0, 2)) + '/' + QString::fromStdString(hash.substr(2));
+    }
+
+    bool contains(const std::string &hash) const {
+        return isHash(hash) && QFile::exists(pathOf(hash));
+    }
+
+    // Makes `target` a link to the stored blob `hash`, unless it already is one.
+    std::string link(const std::string &hash, const QString &target) const {
+        QString blob = pathOf(hash);
+        QByteArray from = QFile::encodeName(blob), to = QFile::encodeName(target);
+        struct stat existing{}, stored{};
+        if (::stat(from.constData(), &stored) != 0) {
+            return "missing blob";
+        }
+        if (::stat(to.constData(), &existing) == 0) {
+            if (existing.st_dev == stored.st_dev && existing.st_ino == stored.st_ino) {
+                return {};
+            }
+            ::unlink(to.constData());
+        }
+        if (::link(from.constData(), to.constData()) == 0 || QFile::copy(blob, target)) {
+            return {};
+        }
+        return "cannot write file";
+    }
+
+private:
+    static constexpr qint64 MEMORY_LIMIT = 8 << 20;
+
+    const QString root;
+    const QString tmp;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_BLOBSTORE_H
@@ -0,0 +1,27 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_CALCSHA256_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_CALCSHA256_H
+
+#include "Metrics.h"
+#include "SHA256.h"
+#include <string>
+
+// Lowercase hex SHA-256 of a password, as the accounts table stores it.
+class CalcSHA256 {
+    std::string s;
+public:
+    CalcSHA256(std::string msg) {
+        static const auto timer = Metrics::timer("gdms_sha256_seconds", "Time to hash a password.");
+        Metrics::Stopwatch hashing(timer);
+        SHA256 sha;
+        sha.update(msg);
+        auto *digest = sha.digest();
+        s = SHA256::toString(digest);
+        delete[] digest;
+    }
+
+    std::string operator()() const {
+        return s;
+    }
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_CALCSHA256_H
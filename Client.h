@@ -0,0 +1,432 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_CLIENT_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_CLIENT_H
+
+#include <qrsaencryption.h>
+#include "system.capnp.h"
+#include "SHA256.h"
+#include "ZipPipeline.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <capnp/ez-rpc.h>
+#include <capnp/message.h>
+#include <kj/debug.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+struct ProjectEntry {
+    int id;
+    std::string name;
+};
+
+// Writes a download below a directory, or a zipped one into a single file.
+class DownloadSinkImpl final : public DownloadSink::Server {
+    QString dest;
+    QFile out;
+    std::string &result;
+
+public:
+    DownloadSinkImpl(const QString &dest, bool zip, std::string &result) : dest(QDir::cleanPath(dest)), result(result) {
+        if (zip) {
+            out.setFileName(this->dest);
+            out.open(QIODevice::WriteOnly | QIODevice::Truncate);
+        }
+    }
+
+    kj::Promise<void> file(FileContext cxt) override {
+        out.close();
+        QString target = QDir::cleanPath(dest + '/' + cxt.getParams().getPath().cStr());
+        KJ_REQUIRE(target.startsWith(dest + '/'), "invalid path in download");
+        QDir().mkpath(QFileInfo(target).path());
+        out.setFileName(target);
+        KJ_REQUIRE(out.open(QIODevice::WriteOnly | QIODevice::Truncate), "cannot write downloaded file");
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<void> write(WriteContext cxt) override {
+        auto bytes = cxt.getParams().getBytes();
+        KJ_REQUIRE(out.write(reinterpret_cast<const char *>(bytes.begin()), bytes.size()) ==
+                   static_cast<qint64>(bytes.size()), "cannot write downloaded file");
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<void> done(DoneContext cxt) override {
+        out.close();
+        result = cxt.getParams().getError().cStr();
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<void> sync(SyncContext) override {
+        return kj::READY_NOW;
+    }
+};
+
+// Blocking wrapper around the System/Session RPCs. Methods return an error message, empty on success.
+class Client {
+    capnp::EzRpcClient client;
+    QByteArray pubkey;
+    std::string fingerprint;
+    System::Client system;
+    Session::Client session;
+    kj::WaitScope &scope;
+    QRSAEncryption e;
+    std::string name;
+    std::string resumeTicket;
+    std::unique_ptr<ZipPipeline> zipper; // started by the first upload
+
+    void keepTicket(capnp::Data::Reader ticket) {
+        resumeTicket.assign(reinterpret_cast<const char *>(ticket.begin()), ticket.size());
+    }
+
+    static std::string collect(Either<BoxedText, ::capnp::List<Project>>::Reader result,
+                               std::vector<ProjectEntry> &out) {
+        if (result.hasLeft()) {
+            return result.getLeft().getValue();
+        }
+        for (const auto &x: result.getRight()) {
+            out.push_back({x.getId(), x.getName()});
+        }
+        return {};
+    }
+
+    template<typename Request>
+    std::string changeRoster(Request req, const std::string &courseName, const std::vector<std::string> &uids) {
+        req.setCourseName(courseName);
+        auto list = req.initUids(uids.size());
+        for (size_t i = 0; i != uids.size(); ++i) {
+            list.set(i, uids[i]);
+        }
+        return req.send().wait(scope).getError();
+    }
+
+public:
+    // Pass `handshake = false` when the connection will be logged in with resume().
+    Client(const std::string &host, const int port, bool handshake = true)
+            : client(host, port), system(client.getMain<System>()), session(nullptr),
+              scope(client.getWaitScope()), e(QRSAEncryption::Rsa::RSA_2048) {
+        if (handshake) {
+            initiateSession();
+        }
+    }
+
+    void initiateSession() {
+        auto response = system.initiateSessionRequest().send().wait(scope);
+        auto pack = response.getPack();
+        fingerprint = pack.getFingerprint();
+        auto pubkeyPtr = pack.getPubkey();
+        pubkey = QByteArray(reinterpret_cast<const char *>(pubkeyPtr.begin()), pubkeyPtr.size());
+    }
+
+    bool login(const std::string &username, const std::string &password) {
+        QByteArray buf(password.c_str());
+        auto enc = e.encode(buf, pubkey);
+        auto req = system.loginRequest();
+        req.setUid(username);
+        req.setFingerprint(fingerprint);
+        req.setPassword(kj::arrayPtr(reinterpret_cast<const kj::byte *>(enc.constData()), enc.size()));
+        auto promise = req.send();
+        // Pipelined: calls made on the session before the reply arrives are queued behind the login.
+        session = promise.getSession();
+        auto response = promise.wait(scope);
+        std::string err = response.getError();
+        if (!err.empty()) {
+            std::cerr << "login failed: " << err << std::endl;
+            return false;
+        } else {
+            name = username;
+            keepTicket(response.getTicket());
+            return true;
+        }
+    }
+
+    // Ticket from the last login or resume; it can be saved and passed to resume() on a later connection.
+    const std::string &ticket() const {
+        return resumeTicket;
+    }
+
+    // Logs in with a ticket instead of a password, skipping initiateSession's key exchange.
+    bool resume(const std::string &ticket) {
+        auto req = system.resumeRequest();
+        req.setTicket(kj::arrayPtr(reinterpret_cast<const kj::byte *>(ticket.data()), ticket.size()));
+        auto promise = req.send();
+        session = promise.getSession();
+        auto response = promise.wait(scope);
+        std::string err = response.getError();
+        if (!err.empty()) {
+            std::cerr << "resume failed: " << err << std::endl;
+            return false;
+        }
+        fingerprint = response.getFingerprint();
+        keepTicket(response.getTicket());
+        return true;
+    }
+
+    void logout() {
+        if (!fingerprint.empty()) {
+            session.logoutRequest().send().wait(scope);
+            fingerprint.clear();
+        }
+    }
+
+    // Streams an existing zip archive to the server. On success the new project id is stored in `*id`.
+    std::string uploadArchive(const std::string &name, const std::string &archive, const std::string &remotePath,
+                              const std::string &course = "", int *id = nullptr) {
+        auto req = session.uploadStreamRequest();
+        req.setName(name);
+        req.setPath(remotePath);
+        req.setCourse(course);
+        auto response = req.send().wait(scope);
+        std::string err = response.getError();
+        if (!err.empty()) {
+            return err;
+        }
+        return sendArchive(response.getSink(), archive, id);
+    }
+
+    // Uploads directory `path`. It is zipped on all cores while the archive is already being sent.
+    std::string upload(const std::string &name, const std::string &path, const std::string &remotePath,
+                       const std::string &course = "", int *id = nullptr) {
+        auto req = session.uploadStreamRequest();
+        req.setName(name);
+        req.setPath(remotePath);
+        req.setCourse(course);
+        auto response = req.send().wait(scope);
+        std::string err = response.getError();
+        if (!err.empty()) {
+            return err;
+        }
+        QDir root(QString::fromStdString(path));
+        return sendFiles(response.getSink(), root, listFiles(root), id);
+    }
+
+    // Like upload(), but only sends files whose content the server does not have yet. The directory is
+    // hashed locally, and the archive sent afterwards holds just the entries the server asked for.
+    std::string uploadDelta(const std::string &name, const std::string &path, const std::string &remotePath,
+                            const std::string &course = "", int *id = nullptr) {
+        QDir root(QString::fromStdString(path));
+        std::vector<QString> files = listFiles(root);
+        auto req = session.uploadDeltaRequest();
+        req.setName(name);
+        req.setPath(remotePath);
+        req.setCourse(course);
+        auto manifest = req.initManifest(files.size());
+        for (size_t i = 0; i != files.size(); ++i) {
+            manifest[i].setPath(root.relativeFilePath(files[i]).toStdString());
+            manifest[i].setSize(QFileInfo(files[i]).size());
+            manifest[i].setSha256(hashFile(files[i]));
+        }
+        auto response = req.send().wait(scope);
+        std::string err = response.getError();
+        if (!err.empty()) {
+            return err;
+        }
+        if (response.getMissing().size() == 0) {
+            return endUpload(response.getSink(), id);
+        }
+        std::vector<QString> missing;
+        for (auto i: response.getMissing()) {
+            missing.push_back(files[i]);
+        }
+        return sendFiles(response.getSink(), root, missing, id);
+    }
+
+private:
+    static constexpr qint64 CHUNK = 64 * 1024;
+
+    static std::string hashFile(const QString &path) {
+        QFile file(path);
+        SHA256 sha;
+        if (file.open(QIODevice::ReadOnly)) {
+            while (!file.atEnd()) {
+                QByteArray chunk = file.read(CHUNK);
+                sha.update(reinterpret_cast<const uint8_t *>(chunk.constData()), chunk.size());
+            }
+        }
+        auto *digest = sha.digest();
+        std::string hash = SHA256::toString(digest);
+        delete[] digest;
+        return hash;
+    }
+
+    static std::vector<QString> listFiles(const QDir &root) {
+        std::vector<QString> files;
+        QDirIterator it(root.path(), QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            files.push_back(it.next());
+        }
+        return files;
+    }
+
+    // Zips `paths` on the fly into `sink` and closes it. Pieces of the archive go out as soon as they
+    // are compressed, in order, while the pipeline keeps compressing ahead.
+    std::string sendFiles(UploadSink::Client sink, const QDir &root, const std::vector<QString> &paths, int *id) {
+        if (!zipper) {
+            zipper = std::make_unique<ZipPipeline>(std::max(1u, std::thread::hardware_concurrency()));
+        }
+        std::vector<ZipPipeline::File> files;
+        for (const auto &path: paths) {
+            files.push_back({path, root.relativeFilePath(path).toStdString()});
+        }
+        std::string err = zipper->send(std::move(files), [sink](std::string piece) mutable {
+            auto write = sink.writeRequest();
+            write.setBytes(kj::arrayPtr(reinterpret_cast<const kj::byte *>(piece.data()), piece.size()));
+            return write.send();
+        }).wait(scope);
+        if (!err.empty()) {
+            return err;
+        }
+        return endUpload(sink, id);
+    }
+
+    // Streams `archive` into `sink` and closes it.
+    std::string sendArchive(UploadSink::Client sink, const std::string &archive, int *id) {
+        std::ifstream input(archive, std::ios::binary);
+        std::vector<char> chunk(CHUNK);
+        // write() is a streaming call: send() only blocks once the flow-control window is full.
+        while (input.read(chunk.data(), chunk.size()) || input.gcount() > 0) {
+            auto write = sink.writeRequest();
+            write.setBytes(kj::arrayPtr(reinterpret_cast<const kj::byte *>(chunk.data()),
+                                        static_cast<size_t>(input.gcount())));
+            write.send().wait(scope);
+        }
+        return endUpload(sink, id);
+    }
+
+    std::string endUpload(UploadSink::Client sink, int *id) {
+        auto end = sink.endRequest().send().wait(scope);
+        if (id) {
+            *id = end.getId();
+        }
+        return end.getError();
+    }
+
+public:
+    // Fetches a project into directory `dest`, or into the zip file `dest`. `owner` is only needed by
+    // teachers fetching someone else's project.
+    std::string download(const std::string &projectId, const std::string &dest, bool zip = false,
+                         const std::string &owner = "") {
+        std::string sinkError;
+        auto req = session.downloadRequest();
+        req.setPid(projectId);
+        req.setOwner(owner);
+        req.setZip(zip);
+        req.setSink(kj::heap<DownloadSinkImpl>(QString::fromStdString(dest), zip, sinkError));
+        std::string err = req.send().wait(scope).getError();
+        return err.empty() ? sinkError : err;
+    }
+
+    std::string exportCourse(const std::string &course, const std::string &dest, bool zip = true) {
+        std::string sinkError;
+        auto req = session.exportCourseRequest();
+        req.setCourse(course);
+        req.setZip(zip);
+        req.setSink(kj::heap<DownloadSinkImpl>(QString::fromStdString(dest), zip, sinkError));
+        std::string err = req.send().wait(scope).getError();
+        return err.empty() ? sinkError : err;
+    }
+
+    std::string remove(const std::string &projectId) {
+        auto req = session.removeRequest();
+        req.setPid(projectId);
+        return req.send().wait(scope).getError();
+    }
+
+    std::string listProject(std::vector<ProjectEntry> &out) {
+        auto response = session.listProjectRequest().send().wait(scope);
+        return collect(response.getResult(), out);
+    }
+
+    // Pages through the whole listing, optionally restricted to one course.
+    std::string listAll(std::vector<ProjectEntry> &out, const std::string &courseName = "", uint32_t pageSize = 0) {
+        std::string cursor;
+        do {
+            auto req = session.listAllRequest();
+            req.setCourseName(courseName);
+            req.setPageSize(pageSize);
+            if (!cursor.empty()) {
+                req.setCursor(kj::arrayPtr(reinterpret_cast<const kj::byte *>(cursor.data()), cursor.size()));
+            }
+            auto response = req.send().wait(scope);
+            std::string err = collect(response.getResult(), out);
+            if (!err.empty()) {
+                return err;
+            }
+            auto next = response.getNextCursor();
+            cursor.assign(reinterpret_cast<const char *>(next.begin()), next.size());
+        } while (!cursor.empty());
+        return {};
+    }
+
+    std::string addStudent(const std::string &uid, const std::string &courseName) {
+        auto req = session.addStudentRequest();
+        req.setUid(uid);
+        req.setCourseName(courseName);
+        return req.send().wait(scope).getError();
+    }
+
+    std::string removeStudent(const std::string &uid, const std::string &courseName) {
+        auto req = session.removeStudentRequest();
+        req.setUid(uid);
+        req.setCourseName(courseName);
+        return req.send().wait(scope).getError();
+    }
+
+    std::string enrollStudents(const std::string &courseName, const std::vector<std::string> &uids) {
+        return changeRoster(session.enrollStudentsRequest(), courseName, uids);
+    }
+
+    std::string unenrollStudents(const std::string &courseName, const std::vector<std::string> &uids) {
+        return changeRoster(session.unenrollStudentsRequest(), courseName, uids);
+    }
+
+    std::string judge(const std::string &owner, const std::string &id, const double score) {
+        auto req = session.judgeRequest();
+        req.setOwner(owner);
+        req.setId(id);
+        req.setScore(score);
+        return req.send().wait(scope).getError();
+    }
+
+    // Grades many projects in one round trip, each given as (owner, project id, score). `status`
+    // receives one entry per grade, empty if it applied.
+    std::string judgeMany(const std::vector<std::tuple<std::string, std::string, double>> &grades,
+                          std::vector<std::string> &status) {
+        auto req = session.judgeManyRequest();
+        auto list = req.initGrades(grades.size());
+        for (size_t i = 0; i != grades.size(); ++i) {
+            list[i].setOwner(std::get<0>(grades[i]));
+            list[i].setId(std::get<1>(grades[i]));
+            list[i].setScore(static_cast<float>(std::get<2>(grades[i])));
+        }
+        auto response = req.send().wait(scope);
+        for (auto x: response.getStatus()) {
+            status.emplace_back(x.cStr());
+        }
+        return response.getError();
+    }
+
+    std::string newCourse(const std::string &courseName) {
+        auto req = session.newCourseRequest();
+        req.setCourseName(courseName);
+        return req.send().wait(scope).getError();
+    }
+
+    // Server metrics in the Prometheus text format.
+    std::string stats() {
+        return system.statsRequest().send().wait(scope).getText();
+    }
+
+    std::string deleteCourse(const std::string &courseId) {
+        auto req = session.deleteCourseRequest();
+        req.setCourseId(courseId);
+        return req.send().wait(scope).getError();
+    }
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_CLIENT_H
@@ -0,0 +1,147 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_DBPOOL_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_DBPOOL_H
+
+#include "WorkerPool.h"
+#include "Metrics.h"
+#include <QString>
+#include <QtSql>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct DbConfig {
+    QString host;
+    int port;
+    QString database;
+    QString username;
+    QString password;
+};
+
+struct SqlStatement {
+    std::string name; // label in the metrics
+    QString sql;
+};
+
+// A worker's database connection with its own prepared copy of every catalog statement. The
+// statements are prepared once, when the connection opens, and afterwards only get new values bound;
+// so Postgres parses and plans each of them once per connection instead of once per request.
+class DbConnection {
+public:
+    // Binds `values` to the placeholders of catalog statement `id` in order and executes it. The
+    // returned query is reused by the next call with the same id; check isActive() for errors.
+    QSqlQuery &exec(size_t id, const QVariantList &values) {
+        auto &s = statements[id];
+        s.query->finish();
+        // A statement that failed to prepare at startup, e.g. because a migration had not yet run on
+        // another connection, is retried here.
+        if (!s.prepared) {
+            s.prepared = s.query->prepare((*catalog)[id].sql);
+        }
+        for (int i = 0; i != values.size(); ++i) {
+            s.query->bindValue(i, values[i]);
+        }
+        Metrics::Stopwatch running(s.timer);
+        if (!s.query->exec()) {
+            Metrics::increment(s.failures);
+        }
+        return *s.query;
+    }
+
+private:
+    friend class DbPool;
+
+    struct Prepared {
+        std::unique_ptr<QSqlQuery> query;
+        bool prepared = false;
+        Metrics::Id timer;
+        Metrics::Id failures;
+    };
+
+    void prepare(const std::vector<SqlStatement> &statementCatalog) {
+        catalog = &statementCatalog;
+        for (const auto &statement: statementCatalog) {
+            std::string labels = "statement=\"" + statement.name + "\"";
+            Prepared p;
+            p.query = std::make_unique<QSqlQuery>(db);
+            p.query->setForwardOnly(true);
+            p.prepared = p.query->prepare(statement.sql);
+            p.timer = Metrics::timer("gdms_sql_seconds", "Execution time of each prepared statement.", labels);
+            p.failures = Metrics::counter("gdms_sql_failures_total", "Failed executions of each prepared statement.",
+                                          labels);
+            statements.push_back(std::move(p));
+        }
+    }
+
+    QSqlDatabase db;
+    const std::vector<SqlStatement> *catalog = nullptr;
+    std::vector<Prepared> statements;
+};
+
+// Runs QSqlQuery work on a pool of threads. Qt only allows a connection to be used from the
+// thread that opened it, so every worker opens its own "QPSQL" connection on startup.
+class DbPool {
+public:
+    using OnOpen = std::function<void(size_t, QSqlDatabase &)>;
+
+    // Every worker prepares all of `catalog`. `onOpen` runs on each worker right after its connection
+    // is opened, before the statements are prepared and before the pool takes work.
+    DbPool(DbConfig config, size_t n, std::vector<SqlStatement> catalog, OnOpen onOpen = {})
+            : config(std::move(config)), catalog(std::move(catalog)), onOpen(std::move(onOpen)),
+              connections(n == 0 ? 1 : n),
+              pool(connections.size(), [this](size_t i) { open(i); }, [this](size_t i) { close(i); }) {
+        if (failed) {
+            throw std::runtime_error("cannot open database");
+        }
+    }
+
+    // Runs `func(DbConnection &)` on a worker and resolves to whatever it returns.
+    template<typename Func>
+    auto run(Func &&func) {
+        static const auto queued = Metrics::timer("gdms_db_queue_seconds",
+                                                  "Time database work waits for a free worker.");
+        static const auto executed = Metrics::timer("gdms_db_query_seconds",
+                                                    "Time spent running database work on a worker.");
+        return pool.run([this, func = kj::fwd<Func>(func), waiting = Metrics::Stopwatch(queued)](size_t i) mutable {
+            { auto done = kj::mv(waiting); }
+            Metrics::Stopwatch running(executed);
+            return func(connections[i]);
+        });
+    }
+
+private:
+    void open(size_t i) {
+        auto &db = connections[i].db = QSqlDatabase::addDatabase("QPSQL", QString("worker-%1").arg(i));
+        db.setHostName(config.host);
+        db.setDatabaseName(config.database);
+        db.setUserName(config.username);
+        db.setPassword(config.password);
+        db.setPort(config.port);
+        if (!db.open()) {
+            failed = true;
+            return;
+        }
+        if (onOpen) {
+            onOpen(i, db);
+        }
+        connections[i].prepare(catalog);
+    }
+
+    void close(size_t i) {
+        QString name = connections[i].db.connectionName();
+        connections[i].statements.clear();
+        connections[i].db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name);
+    }
+
+    DbConfig config;
+    const std::vector<SqlStatement> catalog;
+    OnOpen onOpen;
+    std::vector<DbConnection> connections;
+    std::atomic<bool> failed{false};
+    WorkerPool pool;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_DBPOOL_H
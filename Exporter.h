@@ -0,0 +1,254 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_EXPORTER_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_EXPORTER_H
+
+#include "WorkerPool.h"
+#include "ZipEntry.h"
+#include "system.capnp.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QString>
+#include <capnp/orphan.h>
+#include <kj/async.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pushes file trees into a client's DownloadSink, either file by file or as one zip archive built on
+// the fly. Files are mmap()ed on a worker thread and their pages are handed to capnp as external
+// segments, so the bytes go from the page cache to the socket without being copied into a message.
+// While one file is on the wire the next one is already being mapped.
+class Exporter {
+public:
+    struct Source {
+        QString dir;        // tree on disk
+        std::string prefix; // where the tree goes inside the export
+    };
+
+    explicit Exporter(size_t threads) : pool(threads) {}
+
+    // Resolves to an error message, or an empty string once the sink has acknowledged done(). The
+    // sink is told about errors as well.
+    kj::Promise<std::string> send(std::vector<Source> sources, bool zip, DownloadSink::Client sink) {
+        auto job = kj::heap<Job>(pool, zip, kj::mv(sink));
+        auto &ref = *job;
+        return pool.run([sources = std::move(sources)](size_t) {
+            return list(sources);
+        }).then([&ref](std::vector<Entry> files) {
+            return ref.start(std::move(files));
+        }).attach(kj::mv(job));
+    }
+
+private:
+    static constexpr size_t CHUNK = 1 << 20;
+    static constexpr size_t MAX_MAPPED = 8; // files whose writes may still reference their mapping
+
+    struct Entry {
+        QString source;
+        std::string name;
+    };
+
+    // A read-only mapping of a whole file, unmapped on destruction.
+    struct Mapping {
+        const kj::byte *addr = nullptr;
+        size_t size = 0;
+        uint32_t crc = 0;
+        std::string error;
+
+        Mapping() = default;
+
+        Mapping(Mapping &&other) noexcept
+                : addr(other.addr), size(other.size), crc(other.crc), error(std::move(other.error)) {
+            other.addr = nullptr;
+        }
+
+        Mapping &operator=(Mapping &&) = delete;
+
+        ~Mapping() {
+            if (addr) {
+                ::munmap(const_cast<kj::byte *>(addr), size);
+            }
+        }
+    };
+
+    static std::vector<Entry> list(const std::vector<Source> &sources) {
+        std::vector<Entry> files;
+        for (const auto &source: sources) {
+            QDir root(source.dir);
+            QDirIterator it(source.dir, QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot,
+                            QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                QString path = it.next();
+                files.push_back({path, source.prefix + root.relativeFilePath(path).toStdString()});
+            }
+        }
+        std::sort(files.begin(), files.end(), [](const Entry &a, const Entry &b) {
+            return a.name < b.name;
+        });
+        return files;
+    }
+
+    static Mapping map(const QString &path, bool withCrc) {
+        Mapping m;
+        QByteArray name = QFile::encodeName(path);
+        int fd = ::open(name.constData(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || ::fstat(fd, &st) != 0) {
+            m.error = "cannot open " + path.toStdString();
+        } else if (st.st_size > 0) {
+            void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                m.error = "cannot map " + path.toStdString();
+            } else {
+                ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                m.addr = static_cast<const kj::byte *>(addr);
+                m.size = static_cast<size_t>(st.st_size);
+            }
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (withCrc && m.addr) {
+            uLong crc = ::crc32(0, Z_NULL, 0);
+            for (size_t done = 0; done < m.size;) {
+                auto n = static_cast<uInt>(std::min<size_t>(m.size - done, 1u << 30));
+                crc = ::crc32(crc, m.addr + done, n);
+                done += n;
+            }
+            m.crc = static_cast<uint32_t>(crc);
+        }
+        return m;
+    }
+
+    // State of one export. A streaming write resolves as soon as flow control allows the next one, while
+    // the message may still be queued for the socket, so mappings are kept until the sink has answered
+    // a non-streaming call made after their writes. Once MAX_MAPPED files are held that is a sync();
+    // the rest are released with the Job, after done() has been answered.
+    class Job {
+    public:
+        Job(WorkerPool &pool, bool zip, DownloadSink::Client sink) : pool(pool), zip(zip), sink(kj::mv(sink)) {}
+
+        kj::Promise<std::string> start(std::vector<Entry> entries) {
+            files = std::move(entries);
+            if (zip && files.size() > ZipEntry::MAX_ENTRIES) {
+                return done("too many files for a zip archive");
+            }
+            if (files.empty()) {
+                return finish();
+            }
+            return next(0, mapAsync(0));
+        }
+
+    private:
+        kj::Promise<Mapping> mapAsync(size_t i) {
+            return pool.run([source = files[i].source, zip = zip](size_t) {
+                return map(source, zip);
+            });
+        }
+
+        kj::Promise<std::string> next(size_t i, kj::Promise<Mapping> current) {
+            return current.then([this, i](Mapping m) -> kj::Promise<std::string> {
+                if (!m.error.empty()) {
+                    return done(m.error);
+                }
+                auto following = i + 1 < files.size() ? mapAsync(i + 1) : kj::Promise<Mapping>(Mapping());
+                kj::ArrayPtr<const kj::byte> data(m.addr, m.size);
+                uint32_t crc = m.crc;
+                mappings.push_back(std::move(m));
+                kj::Promise<void> sent = nullptr;
+                if (zip) {
+                    // Entries are stored, with the CRC computed while mapping, so the archive can be
+                    // written strictly front to back.
+                    ZipEntry entry{files[i].name, ZipEntry::STORED, ZipEntry::UTF8_NAMES, crc, data.size(), data.size(),
+                                   offset};
+                    std::string header = entry.localHeader();
+                    if (offset + header.size() + data.size() > ZipEntry::MAX_SIZE) {
+                        return done("export too large for a zip archive");
+                    }
+                    central += entry.centralHeader();
+                    offset += header.size() + data.size();
+                    sent = writeCopy(std::move(header));
+                } else {
+                    auto req = sink.fileRequest();
+                    req.setPath(files[i].name);
+                    req.setSize(data.size());
+                    sent = req.send();
+                }
+                return sent.then([this, data] {
+                    return writeMapped(data);
+                }).then([this] {
+                    return settle();
+                }).then([this, i, following = kj::mv(following)]() mutable {
+                    return i + 1 == files.size() ? finish() : next(i + 1, kj::mv(following));
+                });
+            });
+        }
+
+        // Sends the mapped bytes chunk by chunk as external data. Chunk boundaries stay word-aligned,
+        // as capnp requires for external segments.
+        kj::Promise<void> writeMapped(kj::ArrayPtr<const kj::byte> data) {
+            if (data.size() == 0) {
+                return kj::READY_NOW;
+            }
+            size_t n = std::min(data.size(), CHUNK);
+            auto req = sink.writeRequest();
+            auto orphanage = capnp::Orphanage::getForMessageContaining<DownloadSink::WriteParams::Builder>(req);
+            req.adoptBytes(orphanage.referenceExternalData(capnp::Data::Reader(data.begin(), n)));
+            return req.send().then([this, rest = data.slice(n, data.size())] {
+                return writeMapped(rest);
+            });
+        }
+
+        // Releases the held mappings once the sink has answered a sync() sent after all their writes.
+        kj::Promise<void> settle() {
+            if (mappings.size() < MAX_MAPPED) {
+                return kj::READY_NOW;
+            }
+            return sink.syncRequest().send().then([this](auto) {
+                mappings.clear();
+            });
+        }
+
+        kj::Promise<void> writeCopy(std::string bytes) {
+            auto req = sink.writeRequest();
+            req.setBytes(kj::arrayPtr(reinterpret_cast<const kj::byte *>(bytes.data()), bytes.size()));
+            return req.send();
+        }
+
+        kj::Promise<std::string> finish() {
+            if (!zip) {
+                return done("");
+            }
+            std::string tail = central + ZipEntry::endOfCentralDirectory(files.size(), central.size(), offset);
+            return writeCopy(std::move(tail)).then([this] {
+                return done("");
+            });
+        }
+
+        kj::Promise<std::string> done(std::string error) {
+            auto req = sink.doneRequest();
+            req.setError(error);
+            return req.send().then([error = std::move(error)](auto) {
+                return error;
+            });
+        }
+
+        WorkerPool &pool;
+        const bool zip;
+        DownloadSink::Client sink;
+        std::vector<Entry> files;
+        std::vector<Mapping> mappings;
+        std::string central;
+        uint64_t offset = 0;
+    };
+
+    WorkerPool pool;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_EXPORTER_H
@@ -0,0 +1,195 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_EXTRACTOR_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_EXTRACTOR_H
+
+#include "BlobStore.h"
+#include "WorkerPool.h"
+#include "Metrics.h"
+#include <QuaZip-Qt5-1.3/quazip/quazip.h>
+#include <QuaZip-Qt5-1.3/quazip/quazipfile.h>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <QString>
+#include <kj/async.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Read-only QIODevice over bytes that already live in memory (a capnp Data field or a mapped file).
+// Unlike QBuffer it does not need a QByteArray, so it is not limited to 2 GiB.
+class MemoryDevice final : public QIODevice {
+    kj::ArrayPtr<const kj::byte> data;
+
+public:
+    explicit MemoryDevice(kj::ArrayPtr<const kj::byte> data) : data(data) {}
+
+    bool isSequential() const override {
+        return false;
+    }
+
+    qint64 size() const override {
+        return static_cast<qint64>(data.size());
+    }
+
+protected:
+    qint64 readData(char *out, qint64 max) override {
+        qint64 n = std::min(max, size() - pos());
+        if (n <= 0) {
+            return 0;
+        }
+        std::memcpy(out, data.begin() + pos(), n);
+        return n;
+    }
+
+    qint64 writeData(const char *, qint64) override {
+        return -1;
+    }
+};
+
+// Extracts zip archives straight from memory into a BlobStore. Entries are split round-robin into one
+// slice per worker; every worker opens its own view of the archive and inflates its slice independently.
+class Extractor {
+public:
+    Extractor(size_t threads, const BlobStore &store) : store(store), pool(threads) {}
+
+    // Extracts `archive` below `dest`. The bytes must stay valid until the returned promise resolves,
+    // which yields an error message, or an empty string on success.
+    kj::Promise<std::string> extract(kj::ArrayPtr<const kj::byte> archive, const QString &dest) {
+        static const auto timer = Metrics::timer("gdms_extract_seconds", "Time to extract an uploaded archive.");
+        size_t slices = pool.size();
+        auto jobs = kj::heapArrayBuilder<kj::Promise<std::string>>(slices);
+        for (size_t k = 0; k != slices; ++k) {
+            jobs.add(pool.run([this, archive, dest, k, slices](size_t) {
+                return extractSlice(store, archive, dest, k, slices);
+            }));
+        }
+        return Metrics::timed(timer, kj::joinPromises(jobs.finish())).then([](kj::Array<std::string> errors) {
+            return firstError(kj::mv(errors));
+        });
+    }
+
+    // Which of `hashes` are stored blobs that a file below `tree` already links to, in the same order.
+    // Blobs only reachable from other trees count as absent, so naming a hash neither proves access to
+    // its content nor reveals whether anybody else stored it.
+    kj::Promise<std::vector<bool>> contains(std::vector<std::string> hashes, const QString &tree) {
+        return pool.run([this, hashes = std::move(hashes), tree](size_t) {
+            std::set<std::pair<dev_t, ino_t>> linked;
+            QDirIterator it(tree, QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+            struct stat st{};
+            while (it.hasNext()) {
+                if (::stat(QFile::encodeName(it.next()).constData(), &st) == 0) {
+                    linked.emplace(st.st_dev, st.st_ino);
+                }
+            }
+            std::vector<bool> found;
+            found.reserve(hashes.size());
+            for (const auto &hash: hashes) {
+                found.push_back(store.contains(hash)
+                                && ::stat(QFile::encodeName(store.pathOf(hash)).constData(), &st) == 0
+                                && linked.count({st.st_dev, st.st_ino}) != 0);
+            }
+            return found;
+        });
+    }
+
+    // Links stored blobs into the tree below `dest`; `files` holds (relative path, hash) pairs. The work
+    // is split between the workers like an extraction, and the result is an error message or empty.
+    kj::Promise<std::string> link(std::vector<std::pair<std::string, std::string>> files, const QString &dest) {
+        auto shared = std::make_shared<const std::vector<std::pair<std::string, std::string>>>(std::move(files));
+        size_t slices = pool.size();
+        auto jobs = kj::heapArrayBuilder<kj::Promise<std::string>>(slices);
+        for (size_t k = 0; k != slices; ++k) {
+            jobs.add(pool.run([this, shared, dest, k, slices](size_t) -> std::string {
+                const QString root = QDir::cleanPath(dest) + '/';
+                for (size_t i = k; i < shared->size(); i += slices) {
+                    const auto &[path, hash] = (*shared)[i];
+                    QString target = QDir::cleanPath(root + QString::fromStdString(path));
+                    if (!target.startsWith(root)) {
+                        return "invalid entry name: " + path;
+                    }
+                    QDir().mkpath(QFileInfo(target).path());
+                    std::string error = store.link(hash, target);
+                    if (!error.empty()) {
+                        return error + ": " + path;
+                    }
+                }
+                return {};
+            }));
+        }
+        return kj::joinPromises(jobs.finish()).then([](kj::Array<std::string> errors) {
+            return firstError(kj::mv(errors));
+        });
+    }
+
+private:
+    static constexpr qint64 CHUNK = 1 << 20;
+
+    static std::string firstError(kj::Array<std::string> errors) {
+        for (auto &error: errors) {
+            if (!error.empty()) {
+                return kj::mv(error);
+            }
+        }
+        return {};
+    }
+
+    static std::string extractSlice(const BlobStore &store, kj::ArrayPtr<const kj::byte> archive,
+                                    const QString &dest, size_t slice, size_t slices) {
+        MemoryDevice device(archive);
+        device.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+        QuaZip zip(&device);
+        if (!zip.open(QuaZip::mdUnzip)) {
+            return "cannot open archive";
+        }
+        const QString root = QDir::cleanPath(dest) + '/';
+        std::vector<char> buf(CHUNK);
+        size_t index = 0;
+        for (bool more = zip.goToFirstFile(); more; more = zip.goToNextFile(), ++index) {
+            if (index % slices != slice) {
+                continue;
+            }
+            QString name = zip.getCurrentFileName();
+            QString target = QDir::cleanPath(root + name);
+            if (!target.startsWith(root)) {
+                return "invalid entry name: " + name.toStdString();
+            }
+            if (name.endsWith('/')) {
+                QDir().mkpath(target);
+                continue;
+            }
+            QDir().mkpath(QFileInfo(target).path());
+            QuaZipFile in(&zip);
+            if (!in.open(QIODevice::ReadOnly)) {
+                return "cannot read entry: " + name.toStdString();
+            }
+            auto out = store.writer();
+            qint64 n;
+            while ((n = in.read(buf.data(), CHUNK)) > 0) {
+                if (!out.write(buf.data(), n)) {
+                    return "cannot write file: " + name.toStdString();
+                }
+            }
+            in.close();
+            if (n < 0 || in.getZipError() != UNZ_OK) {
+                return "corrupt entry: " + name.toStdString();
+            }
+            std::string error = out.commit(target);
+            if (!error.empty()) {
+                return error + ": " + name.toStdString();
+            }
+        }
+        return {};
+    }
+
+    const BlobStore &store;
+    WorkerPool pool;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_EXTRACTOR_H
@@ -0,0 +1,19 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_FINGERPRINT_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_FINGERPRINT_H
+
+#include <random>
+#include <string>
+
+// Session fingerprint handed out by initiateSession: 64 uppercase letters from a generator freshly
+// seeded from `r`.
+inline std::string generateFingerprint(std::random_device &r) {
+    std::default_random_engine e1(r());
+    std::uniform_int_distribution<char> dist('A', 'Z');
+    std::string fingerprint;
+    for (int i = 0; i != 64; ++i) {
+        fingerprint += dist(e1);
+    }
+    return fingerprint;
+}
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_FINGERPRINT_H
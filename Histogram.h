@@ -0,0 +1,112 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_HISTOGRAM_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+// Log-linear histogram: every power of two is split into 32 linear sub-buckets, so any recorded value
+// is reported within about 3% of its true value, over the whole uint64 range, in fixed memory.
+// record() may only be called from one thread at a time; reads and merge() are safe from any thread.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    void record(uint64_t value) {
+        bump(buckets[indexOf(value)], 1);
+        bump(total, 1);
+        bump(valueSum, value);
+        if (value > max.load(std::memory_order_relaxed)) {
+            max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void merge(const Histogram &other) {
+        for (size_t i = 0; i != BUCKETS; ++i) {
+            buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        total.fetch_add(other.count(), std::memory_order_relaxed);
+        valueSum.fetch_add(other.sum(), std::memory_order_relaxed);
+        uint64_t otherMax = other.maximum();
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while (otherMax > current && !max.compare_exchange_weak(current, otherMax, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const {
+        return valueSum.load(std::memory_order_relaxed);
+    }
+
+    uint64_t maximum() const {
+        return max.load(std::memory_order_relaxed);
+    }
+
+    double mean() const {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum()) / n : 0.0;
+    }
+
+    // Number of recorded values up to `bound`, counting the whole bucket that `bound` falls in.
+    uint64_t countAtMost(uint64_t bound) const {
+        uint64_t n = 0;
+        for (size_t i = 0, last = indexOf(bound); i <= last; ++i) {
+            n += buckets[i].load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // Smallest bucket bound that at least `q` (0..1) of the recorded values fall under.
+    uint64_t quantile(double q) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(std::ceil(q * n));
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for (size_t i = 0; i != BUCKETS; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return i + 1 == BUCKETS ? maximum() : std::min(valueOf(i + 1) - 1, maximum());
+            }
+        }
+        return maximum();
+    }
+
+private:
+    static void bump(std::atomic<uint64_t> &counter, uint64_t by) {
+        // Single writer, so a plain load/store keeps readers consistent without a locked add.
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    static size_t indexOf(uint64_t value) {
+        if (value < SUB) {
+            return value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return (static_cast<size_t>(shift + 1) << SUB_BITS) | ((value >> shift) & (SUB - 1));
+    }
+
+    static uint64_t valueOf(size_t index) {
+        if (index < SUB) {
+            return index;
+        }
+        int shift = static_cast<int>(index >> SUB_BITS) - 1;
+        return (SUB | (index & (SUB - 1))) << shift;
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> valueSum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_HISTOGRAM_H
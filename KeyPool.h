@@ -0,0 +1,148 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_KEYPOOL_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_KEYPOOL_H
+
+#include "Metrics.h"
+#include <qrsaencryption.h>
+#include <QByteArray>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Stock of pre-generated RSA key pairs. Worker threads start refilling once the pool drops to the
+// low watermark and keep going until it reaches the high watermark, so that initiateSession only
+// has to pop a pair instead of running the key generation on the event loop.
+// Hits, misses and generated pairs are also exported as counters, so the refill rate is their rate().
+class KeyPool {
+public:
+    using KeyPair = std::pair<QByteArray, QByteArray>;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t generated;
+        size_t size;
+        double refillRate; // pairs generated per second since the pool was created
+    };
+
+    KeyPool(QRSAEncryption::Rsa rsa, size_t low, size_t high, unsigned workers)
+            : rsa(rsa), low(low), high(std::max(low + 1, high)), start(std::chrono::steady_clock::now()) {
+        for (unsigned i = 0; i != workers; ++i) {
+            threads.emplace_back([this] { refill(); });
+        }
+    }
+
+    KeyPool(const KeyPool &) = delete;
+
+    KeyPool &operator=(const KeyPool &) = delete;
+
+    ~KeyPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wanted.notify_all();
+        for (auto &t: threads) {
+            t.join();
+        }
+    }
+
+    std::optional<KeyPair> tryPop() {
+        static const auto hitCount = Metrics::counter("gdms_key_pool_hits_total",
+                                                      "initiateSession calls served from the key pool.");
+        static const auto missCount = Metrics::counter("gdms_key_pool_misses_total",
+                                                       "initiateSession calls that generated a key pair inline.");
+        std::unique_lock lock(mutex);
+        if (pool.empty()) {
+            lock.unlock();
+            misses.fetch_add(1, std::memory_order_relaxed);
+            Metrics::increment(missCount);
+            wanted.notify_all();
+            return std::nullopt;
+        }
+        KeyPair pair = std::move(pool.front());
+        pool.pop_front();
+        bool belowLow = pool.size() <= low;
+        lock.unlock();
+        hits.fetch_add(1, std::memory_order_relaxed);
+        Metrics::increment(hitCount);
+        if (belowLow) {
+            wanted.notify_all();
+        }
+        return pair;
+    }
+
+    Stats stats() const {
+        size_t size;
+        {
+            std::lock_guard lock(mutex);
+            size = pool.size();
+        }
+        uint64_t made = generated.load(std::memory_order_relaxed);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return {hits.load(std::memory_order_relaxed), misses.load(std::memory_order_relaxed), made, size,
+                elapsed.count() > 0 ? made / elapsed.count() : 0.0};
+    }
+
+private:
+    bool needsRefill() const {
+        return pool.size() + inflight < high && (filling || pool.size() <= low);
+    }
+
+    void refill() {
+        static const auto timer = Metrics::timer("gdms_rsa_keygen_seconds", "Time to generate an RSA key pair.",
+                                                 "source=\"pool\"");
+        static const auto refills = Metrics::counter("gdms_key_pool_generated_total",
+                                                     "RSA key pairs generated by the refill workers.");
+        QRSAEncryption e(rsa);
+        std::unique_lock lock(mutex);
+        while (true) {
+            wanted.wait(lock, [this] { return stopping || needsRefill(); });
+            if (stopping) {
+                return;
+            }
+            filling = true;
+            ++inflight;
+            lock.unlock();
+            QByteArray pub, priv;
+            {
+                Metrics::Stopwatch generating(timer);
+                e.generatePairKey(pub, priv);
+            }
+            Metrics::increment(refills);
+            lock.lock();
+            --inflight;
+            pool.emplace_back(std::move(pub), std::move(priv));
+            generated.fetch_add(1, std::memory_order_relaxed);
+            if (pool.size() + inflight >= high) {
+                filling = false;
+            }
+        }
+    }
+
+    const QRSAEncryption::Rsa rsa;
+    const size_t low;
+    const size_t high;
+    const std::chrono::steady_clock::time_point start;
+
+    mutable std::mutex mutex;
+    std::condition_variable wanted;
+    std::deque<KeyPair> pool;
+    size_t inflight = 0;
+    bool filling = false;
+    bool stopping = false;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> generated{0};
+
+    std::vector<std::thread> threads;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_KEYPOOL_H
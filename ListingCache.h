@@ -0,0 +1,135 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_LISTINGCACHE_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_LISTINGCACHE_H
+
+#include "MessagePool.h"
+#include "Metrics.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Read-through cache of project listings, shared by all event-loop threads. Entries are already
+// encoded as capnp messages, so a hit costs a lookup and no database round trip or encoding.
+// Every entry carries tags naming what it was read from ("user:<uid>", "course:<name>", ...), and
+// writers invalidate exactly the tags they touched. The least recently used entries are evicted
+// once the encoded size exceeds the capacity.
+class ListingCache {
+public:
+    struct Listing {
+        PooledMessage message; // sealed; its root is the listing
+        std::string nextCursor;
+
+        explicit Listing(size_t words) : message(words) {}
+    };
+
+    explicit ListingCache(size_t capacity) : capacity(capacity) {}
+
+    bool enabled() const {
+        return capacity != 0;
+    }
+
+    std::shared_ptr<const Listing> get(const std::string &key) {
+        static const auto hits = Metrics::counter("gdms_listing_cache_hits_total", "Listings served from the cache.");
+        static const auto misses = Metrics::counter("gdms_listing_cache_misses_total",
+                                                    "Listings read from the database.");
+        if (!enabled()) {
+            return nullptr;
+        }
+        std::lock_guard lock(mutex);
+        auto found = index.find(key);
+        if (found == index.end()) {
+            Metrics::increment(misses);
+            return nullptr;
+        }
+        Metrics::increment(hits);
+        lru.splice(lru.begin(), lru, found->second);
+        return found->second->listing;
+    }
+
+    // Take a version before reading the database and hand it to put(). A listing read while an
+    // invalidation happened may already be stale, so it is not stored.
+    uint64_t version() {
+        std::lock_guard lock(mutex);
+        return generation;
+    }
+
+    void put(const std::string &key, std::vector<std::string> tags, uint64_t readAt,
+             std::shared_ptr<const Listing> listing) {
+        size_t size = listing->message.sizeInWords() * sizeof(capnp::word) + listing->nextCursor.size() + key.size();
+        std::lock_guard lock(mutex);
+        if (readAt != generation || size > capacity) {
+            return;
+        }
+        if (auto found = index.find(key); found != index.end()) {
+            erase(found->second);
+        }
+        for (const auto &tag: tags) {
+            tagged[tag].insert(key);
+        }
+        lru.push_front({key, std::move(tags), std::move(listing), size});
+        index[key] = lru.begin();
+        bytes += size;
+        while (bytes > capacity) {
+            erase(std::prev(lru.end()));
+        }
+    }
+
+    void invalidate(const std::vector<std::string> &tags) {
+        std::lock_guard lock(mutex);
+        ++generation;
+        for (const auto &tag: tags) {
+            auto found = tagged.find(tag);
+            if (found == tagged.end()) {
+                continue;
+            }
+            auto keys = std::move(found->second);
+            tagged.erase(found);
+            for (const auto &key: keys) {
+                if (auto entry = index.find(key); entry != index.end()) {
+                    erase(entry->second);
+                }
+            }
+        }
+    }
+
+    size_t size() {
+        std::lock_guard lock(mutex);
+        return bytes;
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<std::string> tags;
+        std::shared_ptr<const Listing> listing;
+        size_t size;
+    };
+
+    void erase(std::list<Entry>::iterator entry) {
+        for (const auto &tag: entry->tags) {
+            if (auto found = tagged.find(tag); found != tagged.end()) {
+                found->second.erase(entry->key);
+                if (found->second.empty()) {
+                    tagged.erase(found);
+                }
+            }
+        }
+        bytes -= entry->size;
+        index.erase(entry->key);
+        lru.erase(entry);
+    }
+
+    const size_t capacity;
+    std::mutex mutex;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::unordered_map<std::string, std::unordered_set<std::string>> tagged;
+    size_t bytes = 0;
+    uint64_t generation = 0;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_LISTINGCACHE_H
@@ -0,0 +1,394 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_MEMORYSTORAGE_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_MEMORYSTORAGE_H
+
+#include "Storage.h"
+#include <QString>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Keeps everything in process memory, for benchmarking the server without Postgres and Redis and
+// for load tests on a bare machine. One instance is shared by all event-loop threads: sessions and
+// the rest of the data each sit behind their own lock, and every operation completes before it
+// returns. Nothing survives a restart; accounts are added with addAccount() at startup.
+class MemoryStorage final : public Storage {
+public:
+    void addAccount(const std::string &uid, const std::string &passwordHash, bool teacher) {
+        std::unique_lock lock(dataMutex);
+        accounts[uid].passwordHash = passwordHash;
+        if (teacher) {
+            teachers.insert(uid);
+        }
+    }
+
+    kj::Promise<void> createSession(const std::string &fingerprint, const QByteArray &pubkey,
+                                    const QByteArray &privkey) override {
+        std::lock_guard lock(sessionMutex);
+        auto now = std::chrono::steady_clock::now();
+        if (sessions.size() >= sweepAt) {
+            sweep(now);
+        }
+        auto &s = sessions[fingerprint];
+        s.pubkey = pubkey;
+        s.privkey = privkey;
+        s.expires = now + SESSION_TTL;
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<std::optional<QByteArray>> privateKey(const std::string &fingerprint) override {
+        std::lock_guard lock(sessionMutex);
+        auto s = find(fingerprint);
+        if (!s || s->pubkey.isNull() || s->privkey.isNull()) {
+            return std::optional<QByteArray>();
+        }
+        return std::optional<QByteArray>(s->privkey);
+    }
+
+    kj::Promise<void> setLogin(const std::string &fingerprint, const std::string &uid) override {
+        std::lock_guard lock(sessionMutex);
+        auto &s = sessions[fingerprint];
+        if (s.expires < std::chrono::steady_clock::now()) {
+            s = Session{};
+        }
+        s.loginAs = uid;
+        s.expires = std::chrono::steady_clock::now() + SESSION_TTL;
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<std::optional<std::string>> loginOf(const std::string &fingerprint) override {
+        std::lock_guard lock(sessionMutex);
+        auto s = find(fingerprint);
+        if (!s || s->loginAs.empty()) {
+            return std::optional<std::string>();
+        }
+        return std::optional<std::string>(s->loginAs);
+    }
+
+    kj::Promise<void> endSession(const std::string &fingerprint) override {
+        std::lock_guard lock(sessionMutex);
+        sessions.erase(fingerprint);
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<std::optional<Credentials>> credentials(const std::string &uid) override {
+        std::shared_lock lock(dataMutex);
+        auto found = accounts.find(uid);
+        if (found == accounts.end()) {
+            return std::optional<Credentials>();
+        }
+        return std::optional<Credentials>(Credentials{found->second.passwordHash, found->second.ticketEpoch});
+    }
+
+    kj::Promise<std::optional<int64_t>> ticketEpoch(const std::string &uid) override {
+        std::shared_lock lock(dataMutex);
+        auto found = accounts.find(uid);
+        if (found == accounts.end()) {
+            return std::optional<int64_t>();
+        }
+        return std::optional<int64_t>(found->second.ticketEpoch);
+    }
+
+    kj::Promise<void> revokeTickets(const std::string &uid) override {
+        std::unique_lock lock(dataMutex);
+        if (auto found = accounts.find(uid); found != accounts.end()) {
+            ++found->second.ticketEpoch;
+        }
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<StoredProject> recordProject(const std::string &user, const std::string &name,
+                                             const std::string &path, const std::string &course) override {
+        std::unique_lock lock(dataMutex);
+        auto account = accounts.find(user);
+        if (account == accounts.end()) {
+            return StoredProject{"non-existent account"};
+        }
+        int pid = account->second.counter++;
+        projects[{pid, user}] = {QString::fromStdString(name).toUtf8(), path, course};
+        pidsOf[user].insert(pid);
+        return StoredProject{"", pid};
+    }
+
+    kj::Promise<std::pair<std::string, std::string>> projectPath(const std::string &user, const std::string &owner,
+                                                                 const std::string &pid) override {
+        std::shared_lock lock(dataMutex);
+        if (owner != user && !teachers.count(user)) {
+            return std::make_pair(std::string(NOT_TEACHER), std::string());
+        }
+        auto found = findProject(owner, pid);
+        if (found == projects.end()) {
+            return std::make_pair(std::string("no such project"), std::string());
+        }
+        return std::make_pair(std::string(), found->second.path);
+    }
+
+    kj::Promise<std::pair<std::string, std::vector<CourseProject>>> courseProjects(
+            const std::string &user, const std::string &course) override {
+        using Found = std::pair<std::string, std::vector<CourseProject>>;
+        std::shared_lock lock(dataMutex);
+        if (!teachers.count(user)) {
+            return Found{NOT_TEACHER, {}};
+        }
+        std::vector<CourseProject> found;
+        for (const auto &[key, project]: projects) {
+            if (project.course == course) {
+                found.push_back({key.second, std::to_string(key.first), project.name.toStdString(), project.path});
+            }
+        }
+        // Projects are visited by pid, so a stable sort by owner orders them by (owner, pid).
+        std::stable_sort(found.begin(), found.end(), [](const CourseProject &a, const CourseProject &b) {
+            return a.owner < b.owner;
+        });
+        return Found{"", std::move(found)};
+    }
+
+    kj::Promise<std::optional<std::string>> removeProject(const std::string &user, const std::string &pid) override {
+        std::unique_lock lock(dataMutex);
+        auto found = findProject(user, pid);
+        if (found == projects.end()) {
+            return std::optional<std::string>();
+        }
+        std::string course = found->second.course;
+        pidsOf[user].erase(found->first.first);
+        projects.erase(found);
+        return std::optional<std::string>(std::move(course));
+    }
+
+    kj::Promise<std::shared_ptr<const ListingCache::Listing>> listProjects(const std::string &user,
+                                                                           EncodeListing encode) override {
+        ProjectRows rows;
+        {
+            std::shared_lock lock(dataMutex);
+            if (auto pids = pidsOf.find(user); pids != pidsOf.end()) {
+                for (int pid: pids->second) {
+                    rows.emplace_back(projects.at({pid, user}).name, pid);
+                }
+            }
+        }
+        return encode(rows, std::nullopt);
+    }
+
+    kj::Promise<std::shared_ptr<const ListingCache::Listing>> listAll(
+            const std::string &course, uint32_t pageSize, const std::optional<ListPosition> &after,
+            EncodeListing encode) override {
+        ProjectRows rows;
+        std::optional<ListPosition> next;
+        std::string lastUser;
+        {
+            std::shared_lock lock(dataMutex);
+            auto at = after ? projects.upper_bound({after->pid, after->user}) : projects.begin();
+            for (; at != projects.end(); ++at) {
+                if (!course.empty() && at->second.course != course) {
+                    continue;
+                }
+                if (rows.size() == pageSize) {
+                    next = ListPosition{rows.back().second, lastUser};
+                    break;
+                }
+                rows.emplace_back(at->second.name, at->first.first);
+                lastUser = at->first.second;
+            }
+        }
+        return encode(rows, next);
+    }
+
+    kj::Promise<std::pair<std::string, std::optional<GradedProject>>> judge(
+            const std::string &user, const std::string &owner, const std::string &pid, float score) override {
+        using Graded = std::pair<std::string, std::optional<GradedProject>>;
+        std::unique_lock lock(dataMutex);
+        if (!teachers.count(user)) {
+            return Graded{NOT_TEACHER, std::nullopt};
+        }
+        auto found = findProject(owner, pid);
+        if (found == projects.end()) {
+            return Graded{"no such project", std::nullopt};
+        }
+        found->second.score = score;
+        return Graded{"", GradedProject{found->first.first, owner, found->second.course}};
+    }
+
+    kj::Promise<std::pair<std::string, std::vector<GradedProject>>> judgeMany(
+            const std::string &user, std::map<std::pair<std::string, int>, float> scores) override {
+        using Graded = std::pair<std::string, std::vector<GradedProject>>;
+        std::unique_lock lock(dataMutex);
+        if (!teachers.count(user)) {
+            return Graded{NOT_TEACHER, {}};
+        }
+        std::vector<GradedProject> graded;
+        for (const auto &[key, score]: scores) {
+            auto found = projects.find({key.second, key.first});
+            if (found != projects.end()) {
+                found->second.score = score;
+                graded.push_back({key.second, key.first, found->second.course});
+            }
+        }
+        return Graded{"", std::move(graded)};
+    }
+
+    kj::Promise<bool> newCourse(const std::string &user, const std::string &id, const std::string &name) override {
+        std::unique_lock lock(dataMutex);
+        if (!teachers.count(user)) {
+            return false;
+        }
+        courses.emplace(id, name);
+        coursesOf[user].insert(id);
+        idsOf[name].insert(id);
+        return true;
+    }
+
+    kj::Promise<std::string> deleteCourse(const std::string &user, const std::string &id) override {
+        std::unique_lock lock(dataMutex);
+        if (!teachers.count(user)) {
+            return std::string(NOT_TEACHER);
+        }
+        if (!coursesOf[user].erase(id)) {
+            return std::string("no such course");
+        }
+        if (auto course = courses.find(id); course != courses.end()) {
+            idsOf[course->second].erase(id);
+            courses.erase(course);
+        }
+        rosters.erase(id);
+        return std::string();
+    }
+
+    kj::Promise<bool> isEnrolled(const std::string &course, const std::string &uid) override {
+        std::shared_lock lock(dataMutex);
+        auto ids = idsOf.find(course);
+        if (ids == idsOf.end()) {
+            return false;
+        }
+        return std::any_of(ids->second.begin(), ids->second.end(), [&](const std::string &id) {
+            auto roster = rosters.find(id);
+            return roster != rosters.end() && roster->second.count(uid) != 0;
+        });
+    }
+
+    kj::Promise<std::pair<std::string, uint32_t>> enroll(const std::string &user, const std::string &course,
+                                                         std::vector<std::string_view> uids) override {
+        std::unique_lock lock(dataMutex);
+        auto ids = taught(user, course);
+        if (!ids.first.empty()) {
+            return std::make_pair(std::move(ids.first), uint32_t(0));
+        }
+        uint32_t added = 0;
+        for (const auto &id: ids.second) {
+            auto &roster = rosters[id];
+            for (auto uid: uids) {
+                added += roster.emplace(uid).second;
+            }
+        }
+        return std::make_pair(std::string(), added);
+    }
+
+    kj::Promise<std::pair<std::string, uint32_t>> unenroll(const std::string &user, const std::string &course,
+                                                           std::vector<std::string_view> uids) override {
+        std::unique_lock lock(dataMutex);
+        auto ids = taught(user, course);
+        if (!ids.first.empty()) {
+            return std::make_pair(std::move(ids.first), uint32_t(0));
+        }
+        uint32_t removed = 0;
+        for (const auto &id: ids.second) {
+            auto roster = rosters.find(id);
+            for (size_t i = 0; roster != rosters.end() && i != uids.size(); ++i) {
+                removed += roster->second.erase(std::string(uids[i]));
+            }
+        }
+        return std::make_pair(std::string(), removed);
+    }
+
+private:
+    struct Session {
+        QByteArray pubkey;
+        QByteArray privkey;
+        std::string loginAs;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct Account {
+        std::string passwordHash;
+        int counter = 0;
+        int64_t ticketEpoch = 0;
+    };
+
+    struct Project {
+        QByteArray name; // UTF-8
+        std::string path;
+        std::string course; // empty outside a course
+        float score = 0;
+    };
+
+    // Keyed and ordered like listAll pages: (pid, user).
+    using Projects = std::map<std::pair<int, std::string>, Project>;
+
+    // A live session, or nullptr. Callers hold sessionMutex.
+    Session *find(const std::string &fingerprint) {
+        auto found = sessions.find(fingerprint);
+        if (found == sessions.end()) {
+            return nullptr;
+        }
+        if (found->second.expires < std::chrono::steady_clock::now()) {
+            sessions.erase(found);
+            return nullptr;
+        }
+        return &found->second;
+    }
+
+    // Drops expired sessions once their number has doubled since the last sweep, so sessions that
+    // are never looked up again cost amortised constant time to forget.
+    void sweep(std::chrono::steady_clock::time_point now) {
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            it = it->second.expires < now ? sessions.erase(it) : std::next(it);
+        }
+        sweepAt = std::max<size_t>(2 * sessions.size(), 1024);
+    }
+
+    // Callers hold dataMutex.
+    Projects::iterator findProject(const std::string &owner, const std::string &pid) {
+        bool ok;
+        int id = QString::fromStdString(pid).toInt(&ok);
+        return ok ? projects.find({id, owner}) : projects.end();
+    }
+
+    // The ids of the courses named `course` that `user` teaches, or an error message if there are
+    // none. Callers hold dataMutex.
+    std::pair<std::string, std::vector<std::string>> taught(const std::string &user, const std::string &course) {
+        if (!teachers.count(user)) {
+            return {NOT_TEACHER, {}};
+        }
+        std::vector<std::string> ids;
+        if (auto named = idsOf.find(course); named != idsOf.end()) {
+            const auto &own = coursesOf[user];
+            std::set_intersection(named->second.begin(), named->second.end(), own.begin(), own.end(),
+                                  std::back_inserter(ids));
+        }
+        if (ids.empty()) {
+            return {"no such course", {}};
+        }
+        return {"", std::move(ids)};
+    }
+
+    std::mutex sessionMutex;
+    std::unordered_map<std::string, Session> sessions;
+    size_t sweepAt = 1024;
+
+    std::shared_mutex dataMutex;
+    std::unordered_map<std::string, Account> accounts;
+    std::set<std::string> teachers;
+    Projects projects;
+    std::unordered_map<std::string, std::set<int>> pidsOf;      // user -> pids, for listProject
+    std::map<std::string, std::string> courses;                 // id -> name
+    std::map<std::string, std::set<std::string>> coursesOf;     // teacher -> course ids
+    std::map<std::string, std::set<std::string>> idsOf;         // course name -> course ids
+    std::map<std::string, std::set<std::string, std::less<>>> rosters; // course id -> uids
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_MEMORYSTORAGE_H
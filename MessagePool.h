@@ -0,0 +1,156 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_MESSAGEPOOL_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_MESSAGEPOOL_H
+
+#include <capnp/message.h>
+#include <kj/array.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// A capnp message whose first segment comes from a per-thread free list and is sized by the caller's
+// estimate of the message, so building a typical reply takes no allocation at all and does not spill
+// into further segments. MallocMessageBuilder zeroes the used part of a borrowed first segment when it
+// is destroyed, so the segment can be reused as it is. It goes back to the pool of the thread that
+// built the message, even when another thread releases it: messages are typically built on database
+// workers and dropped by an event loop, and the workers are the ones that need the segments again.
+class PooledMessage {
+public:
+    explicit PooledMessage(size_t words) : lease(take(words)), builder(lease.segment.asPtr()) {}
+
+    PooledMessage(const PooledMessage &) = delete;
+
+    capnp::MessageBuilder &get() {
+        return builder;
+    }
+
+    // Snapshots the segments once the message is complete. After that the message may be read from
+    // any number of threads at once through segments().
+    void seal() {
+        auto out = builder.getSegmentsForOutput();
+        sealed = kj::heapArray<kj::ArrayPtr<const capnp::word>>(out.begin(), out.size());
+        words = 0;
+        for (auto s: sealed) {
+            words += s.size();
+        }
+    }
+
+    kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> segments() const {
+        return sealed;
+    }
+
+    size_t sizeInWords() const {
+        return words;
+    }
+
+private:
+    static constexpr size_t MIN_WORDS = 64;
+    static constexpr size_t MAX_POOLED_WORDS = 1 << 20;
+    static constexpr size_t KEEP = 8; // free segments kept per size class and thread
+
+    using FreeLists = std::vector<std::vector<kj::Array<capnp::word>>>;
+
+    // The free segments of one thread. Only that thread touches `lists`; other threads hand segments
+    // back through `returned`, a lock-free stack which the owner empties whenever it takes a segment.
+    struct Pool {
+        struct Returned {
+            kj::Array<capnp::word> segment;
+            Returned *next;
+        };
+
+        FreeLists lists;
+        std::atomic<Returned *> returned{nullptr};
+
+        ~Pool() {
+            for (auto *node = returned.load(std::memory_order_acquire); node;) {
+                auto *next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+
+        void keep(kj::Array<capnp::word> segment) {
+            size_t rounded;
+            size_t c = sizeClass(segment.size(), rounded);
+            if (rounded != segment.size() || rounded > MAX_POOLED_WORDS) {
+                return;
+            }
+            if (lists.size() <= c) {
+                lists.resize(c + 1);
+            }
+            if (lists[c].size() < KEEP) {
+                lists[c].push_back(kj::mv(segment));
+            }
+        }
+
+        // Called from any thread but the owner.
+        void giveBack(kj::Array<capnp::word> segment) {
+            auto *node = new Returned{kj::mv(segment), returned.load(std::memory_order_relaxed)};
+            while (!returned.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+            }
+        }
+
+        // Moves everything other threads have given back into the free lists. Owner only.
+        void reclaim() {
+            for (auto *node = returned.exchange(nullptr, std::memory_order_acquire); node;) {
+                keep(kj::mv(node->segment));
+                auto *next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+    };
+
+    // Shared with the leases taken from it, so segments released after their thread has exited still
+    // have somewhere to go.
+    static const std::shared_ptr<Pool> &pool() {
+        thread_local const auto p = std::make_shared<Pool>();
+        return p;
+    }
+
+    static size_t sizeClass(size_t words, size_t &rounded) {
+        size_t c = 0;
+        for (rounded = MIN_WORDS; rounded < words; rounded <<= 1) {
+            ++c;
+        }
+        return c;
+    }
+
+    // Declared before the builder so that it is destroyed after it, once the segment has been zeroed.
+    struct Lease {
+        kj::Array<capnp::word> segment;
+        std::shared_ptr<Pool> owner;
+
+        ~Lease() {
+            if (owner == pool()) {
+                owner->keep(kj::mv(segment));
+            } else {
+                owner->giveBack(kj::mv(segment));
+            }
+        }
+    };
+
+    static Lease take(size_t words) {
+        size_t rounded;
+        size_t c = sizeClass(words, rounded);
+        const auto &own = pool();
+        own->reclaim();
+        auto &lists = own->lists;
+        if (c < lists.size() && !lists[c].empty()) {
+            auto segment = kj::mv(lists[c].back());
+            lists[c].pop_back();
+            return {kj::mv(segment), own};
+        }
+        auto segment = kj::heapArray<capnp::word>(rounded);
+        std::memset(segment.begin(), 0, segment.asBytes().size());
+        return {kj::mv(segment), own};
+    }
+
+    Lease lease;
+    capnp::MallocMessageBuilder builder;
+    kj::Array<kj::ArrayPtr<const capnp::word>> sealed;
+    size_t words = 0;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_MESSAGEPOOL_H
@@ -0,0 +1,233 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_METRICS_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_METRICS_H
+
+#include "Histogram.h"
+#include <kj/async.h>
+#include <kj/debug.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide timers, counters and gauges, rendered in the Prometheus text format by prometheus().
+// Every thread records into its own shard, so the hot path is a few relaxed stores with no locking
+// or shared cache lines; the shards are only merged when the metrics are read.
+// Series are registered once, usually into a static, and recorded through the returned id.
+class Metrics {
+public:
+    using Id = size_t;
+
+    static constexpr size_t MAX_SERIES = 256;
+
+    // Registers a latency histogram. `labels` is preformatted, e.g. `method="login"`. Registering the
+    // same name and labels twice returns the same id.
+    static Id timer(const std::string &name, const std::string &help, const std::string &labels = "") {
+        return registry().add(name, help, labels, Kind::TIMER);
+    }
+
+    static Id counter(const std::string &name, const std::string &help, const std::string &labels = "") {
+        return registry().add(name, help, labels, Kind::COUNTER);
+    }
+
+    // `read` is called whenever the metrics are rendered, from the thread rendering them and without
+    // the registry locked, so it may take locks of its own that are held while recording metrics.
+    static void gauge(const std::string &name, const std::string &help, std::function<double()> read,
+                      const std::string &labels = "") {
+        auto &r = registry();
+        std::lock_guard lock(r.mutex);
+        r.gauges.push_back({name, help, labels, std::move(read)});
+    }
+
+    static void observe(Id id, std::chrono::nanoseconds elapsed) {
+        auto &slot = shard().histograms[id];
+        Histogram *h = slot.load(std::memory_order_relaxed);
+        if (!h) {
+            h = new Histogram;
+            slot.store(h, std::memory_order_release);
+        }
+        h->record(static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0)));
+    }
+
+    static void increment(Id id, uint64_t by = 1) {
+        auto &c = shard().counters[id];
+        c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    // Records the time between construction and destruction into a timer.
+    class Stopwatch {
+    public:
+        explicit Stopwatch(Id id) : id(id), start(std::chrono::steady_clock::now()) {}
+
+        Stopwatch(Stopwatch &&other) noexcept : id(other.id), start(other.start), armed(other.armed) {
+            other.armed = false;
+        }
+
+        Stopwatch(const Stopwatch &) = delete;
+
+        ~Stopwatch() {
+            if (armed) {
+                observe(id, std::chrono::steady_clock::now() - start);
+            }
+        }
+
+    private:
+        Id id;
+        std::chrono::steady_clock::time_point start;
+        bool armed = true;
+    };
+
+    // Times `promise` from now until it settles or is cancelled.
+    template<typename T>
+    static kj::Promise<T> timed(Id id, kj::Promise<T> promise) {
+        return promise.attach(Stopwatch(id));
+    }
+
+    static std::string prometheus() {
+        auto &r = registry();
+        std::unique_lock lock(r.mutex);
+        std::string out;
+        std::vector<size_t> order(r.series.size());
+        for (size_t i = 0; i != order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&r](size_t a, size_t b) {
+            return r.series[a].name < r.series[b].name;
+        });
+        const std::string *family = nullptr;
+        for (size_t id: order) {
+            const auto &s = r.series[id];
+            if (!family || *family != s.name) {
+                family = &s.name;
+                out += "# HELP " + s.name + " " + s.help + "\n";
+                out += "# TYPE " + s.name + (s.kind == Kind::TIMER ? " histogram\n" : " counter\n");
+            }
+            if (s.kind == Kind::COUNTER) {
+                uint64_t total = 0;
+                for (const auto &shard: r.shards) {
+                    total += shard->counters[id].load(std::memory_order_relaxed);
+                }
+                out += s.name + braces(s.labels) + " " + std::to_string(total) + "\n";
+                continue;
+            }
+            Histogram merged;
+            for (const auto &shard: r.shards) {
+                if (const Histogram *h = shard->histograms[id].load(std::memory_order_acquire)) {
+                    merged.merge(*h);
+                }
+            }
+            std::string prefix = s.labels.empty() ? "" : s.labels + ",";
+            for (double bound: BOUNDS) {
+                auto ns = static_cast<uint64_t>(bound * 1e9);
+                out += s.name + "_bucket{" + prefix + "le=\"" + number(bound) + "\"} " +
+                       std::to_string(merged.countAtMost(ns)) + "\n";
+            }
+            out += s.name + "_bucket{" + prefix + "le=\"+Inf\"} " + std::to_string(merged.count()) + "\n";
+            out += s.name + "_sum" + braces(s.labels) + " " + number(merged.sum() / 1e9) + "\n";
+            out += s.name + "_count" + braces(s.labels) + " " + std::to_string(merged.count()) + "\n";
+        }
+        std::vector<Gauge> gauges = r.gauges;
+        lock.unlock();
+        std::stable_sort(gauges.begin(), gauges.end(), [](const Gauge &a, const Gauge &b) {
+            return a.name < b.name;
+        });
+        family = nullptr;
+        for (const Gauge &g: gauges) {
+            if (!family || *family != g.name) {
+                family = &g.name;
+                out += "# HELP " + g.name + " " + g.help + "\n";
+                out += "# TYPE " + g.name + " gauge\n";
+            }
+            out += g.name + braces(g.labels) + " " + number(g.read()) + "\n";
+        }
+        return out;
+    }
+
+private:
+    enum class Kind {
+        TIMER,
+        COUNTER
+    };
+
+    // Bucket bounds in seconds. Within a bucket the histogram is accurate to about 3%.
+    static constexpr std::array<double, 17> BOUNDS = {0.00001, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+                                                      0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+    struct Series {
+        std::string name;
+        std::string help;
+        std::string labels;
+        Kind kind;
+    };
+
+    struct Gauge {
+        std::string name;
+        std::string help;
+        std::string labels;
+        std::function<double()> read;
+    };
+
+    struct Shard {
+        std::array<std::atomic<Histogram *>, MAX_SERIES> histograms{};
+        std::array<std::atomic<uint64_t>, MAX_SERIES> counters{};
+
+        ~Shard() {
+            for (auto &h: histograms) {
+                delete h.load();
+            }
+        }
+    };
+
+    // Shards outlive their threads, so nothing recorded is lost when a thread exits.
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Series> series;
+        std::vector<Gauge> gauges;
+        std::vector<std::unique_ptr<Shard>> shards;
+
+        Id add(const std::string &name, const std::string &help, const std::string &labels, Kind kind) {
+            std::lock_guard lock(mutex);
+            for (size_t i = 0; i != series.size(); ++i) {
+                if (series[i].name == name && series[i].labels == labels) {
+                    return i;
+                }
+            }
+            KJ_REQUIRE(series.size() < MAX_SERIES, "too many metric series", name);
+            series.push_back({name, help, labels, kind});
+            return series.size() - 1;
+        }
+
+        Shard *newShard() {
+            std::lock_guard lock(mutex);
+            shards.push_back(std::make_unique<Shard>());
+            return shards.back().get();
+        }
+    };
+
+    static Registry &registry() {
+        static Registry r;
+        return r;
+    }
+
+    static Shard &shard() {
+        thread_local Shard *s = registry().newShard();
+        return *s;
+    }
+
+    static std::string braces(const std::string &labels) {
+        return labels.empty() ? "" : "{" + labels + "}";
+    }
+
+    static std::string number(double x) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9g", x);
+        return buf;
+    }
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_METRICS_H
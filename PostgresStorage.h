@@ -0,0 +1,457 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_POSTGRESSTORAGE_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_POSTGRESSTORAGE_H
+
+#include "AsyncRedis.h"
+#include "DbPool.h"
+#include "Storage.h"
+#include <QStringList>
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Every statement the server runs, prepared once per database connection. Sql values index
+// sqlCatalog(), so the two lists must stay in the same order.
+enum Sql : size_t {
+    SQL_CREDENTIALS,
+    SQL_TICKET_EPOCH,
+    SQL_REVOKE_TICKETS,
+    SQL_IS_TEACHER,
+    SQL_RECORD_PROJECT,
+    SQL_PROJECT_PATH,
+    SQL_COURSE_PROJECTS,
+    SQL_REMOVE_PROJECT,
+    SQL_LIST_PROJECTS,
+    SQL_LIST_ALL,               // the next three variants add a course filter, a cursor, or both
+    SQL_LIST_ALL_COURSE,
+    SQL_LIST_ALL_AFTER,
+    SQL_LIST_ALL_COURSE_AFTER,
+    SQL_JUDGE,
+    SQL_JUDGE_MANY,
+    SQL_NEW_COURSE,
+    SQL_DELETE_COURSE,
+};
+
+inline std::vector<SqlStatement> sqlCatalog() {
+    const QString listAll = "SELECT name, pid, \"user\" FROM projects WHERE TRUE";
+    const QString page = " ORDER BY pid, \"user\" LIMIT ?;";
+    const QString course = " AND course = ?", after = " AND (pid, \"user\") > (?, ?)";
+    return {
+            {"credentials", "SELECT password, ticket_epoch FROM accounts WHERE uid = ?;"},
+            {"ticket_epoch", "SELECT ticket_epoch FROM accounts WHERE uid = ?;"},
+            {"revoke_tickets", "UPDATE accounts SET ticket_epoch = ticket_epoch + 1 WHERE uid = ?;"},
+            {"is_teacher", "SELECT 1 FROM teacher WHERE uid = ?;"},
+            // Allocating the id and inserting is one statement, hence one transaction: the UPDATE locks
+            // the account row, so concurrent uploads by a user get distinct ids.
+            {"record_project", "WITH allocated AS ("
+                               "UPDATE accounts SET counter = counter + 1 WHERE uid = ? "
+                               "RETURNING counter - 1 AS pid) "
+                               "INSERT INTO projects (pid, name, \"user\", path, course) "
+                               "SELECT pid, ?, ?, ?, ? FROM allocated RETURNING pid;"},
+            {"project_path", "SELECT path FROM projects WHERE \"user\" = ? AND pid = ?;"},
+            {"course_projects", "SELECT \"user\", pid, name, path FROM projects "
+                                "WHERE course = ? AND path IS NOT NULL ORDER BY \"user\", pid;"},
+            {"remove_project", "DELETE FROM projects WHERE \"user\" = ? AND pid = ? RETURNING course;"},
+            {"list_projects", "SELECT name, pid FROM projects WHERE \"user\" = ?;"},
+            {"list_all", listAll + page},
+            {"list_all_course", listAll + course + page},
+            {"list_all_after", listAll + after + page},
+            {"list_all_course_after", listAll + course + after + page},
+            {"judge", "UPDATE projects SET score = ? WHERE \"user\" = ? AND pid = ? RETURNING course;"},
+            {"judge_many", "UPDATE projects SET score = g.score "
+                           "FROM unnest(?::text[], ?::int4[], ?::float4[]) AS g(owner, pid, score) "
+                           "WHERE projects.\"user\" = g.owner AND projects.pid = g.pid "
+                           "RETURNING g.pid, projects.\"user\", projects.course;"},
+            {"new_course", "INSERT INTO courses VALUES(?,?,?);"},
+            // Course rows are (id, name, teacher), in the order new_course inserts them.
+            {"delete_course", "DELETE FROM courses WHERE \"id\" = ? AND teacher = ? RETURNING *;"},
+    };
+}
+
+// Schema changes the server relies on, applied once at startup by the first database worker.
+inline void migrate(QSqlDatabase &db) {
+    QSqlQuery statement(db);
+    statement.exec("ALTER TABLE projects ADD COLUMN IF NOT EXISTS course TEXT;");
+    statement.exec("ALTER TABLE projects ADD COLUMN IF NOT EXISTS path TEXT;");
+    statement.exec("ALTER TABLE accounts ADD COLUMN IF NOT EXISTS ticket_epoch INT8 NOT NULL DEFAULT 0;");
+    statement.exec("CREATE INDEX IF NOT EXISTS projects_course_pid ON projects (course, pid, \"user\");");
+    statement.exec("CREATE INDEX IF NOT EXISTS projects_pid ON projects (pid, \"user\");");
+}
+
+// The production backend: accounts, projects and courses in Postgres through the shared DbPool,
+// sessions and rosters in Redis through this thread's own AsyncRedis connection.
+class PostgresStorage final : public Storage {
+public:
+    PostgresStorage(DbPool &database, kj::Network &network, std::string redisHost, unsigned redisPort)
+            : database(database), redis(network, std::move(redisHost), redisPort) {}
+
+    // Each session lives in a single hash "<fingerprint>session" holding pubkey, privkey and loginAs,
+    // so one EXPIRE refreshes all of it and every lookup is a single command.
+    static std::string sessionKey(const std::string &fingerprint) {
+        return fingerprint + "session";
+    }
+
+    // Course rosters are Redis sets "<course id>Roster", so checking one is a single SISMEMBER.
+    static std::string rosterKey(const std::string &id) {
+        return id + "Roster";
+    }
+
+    // Clients name courses, so the ids of the courses with each name are kept in a Redis set
+    // "<name>CourseIds" next to the teacher's own "<teacher>Courses".
+    static std::string courseIdsKey(const std::string &name) {
+        return name + "CourseIds";
+    }
+
+    kj::Promise<void> createSession(const std::string &fingerprint, const QByteArray &pubkey,
+                                    const QByteArray &privkey) override {
+        std::string key = sessionKey(fingerprint);
+        auto stored = redis.command({"HSET", key,
+                                     "pubkey", std::string_view(pubkey.constData(), pubkey.size()),
+                                     "privkey", std::string_view(privkey.constData(), privkey.size())});
+        return refresh(key, kj::mv(stored));
+    }
+
+    kj::Promise<std::optional<QByteArray>> privateKey(const std::string &fingerprint) override {
+        return redis.command({"HMGET", sessionKey(fingerprint), "pubkey", "privkey"})
+                .then([](RedisReply session) -> std::optional<QByteArray> {
+                    if (session.elements.size() != 2 || session.elements[0].isNil() || session.elements[1].isNil()) {
+                        return std::nullopt;
+                    }
+                    return QByteArray::fromStdString(session.elements[1].str);
+                });
+    }
+
+    kj::Promise<void> setLogin(const std::string &fingerprint, const std::string &uid) override {
+        std::string key = sessionKey(fingerprint);
+        return refresh(key, redis.command({"HSET", key, "loginAs", uid}));
+    }
+
+    kj::Promise<std::optional<std::string>> loginOf(const std::string &fingerprint) override {
+        return redis.command({"HGET", sessionKey(fingerprint), "loginAs"})
+                .then([](RedisReply user) -> std::optional<std::string> {
+                    if (user.isNil()) {
+                        return std::nullopt;
+                    }
+                    return std::move(user.str);
+                });
+    }
+
+    kj::Promise<void> endSession(const std::string &fingerprint) override {
+        return redis.command({"DEL", sessionKey(fingerprint)}).ignoreResult();
+    }
+
+    kj::Promise<std::optional<Credentials>> credentials(const std::string &uid) override {
+        return database.run([uid](DbConnection &c) -> std::optional<Credentials> {
+            auto &statement = c.exec(SQL_CREDENTIALS, {uid.c_str()});
+            if (statement.next()) {
+                return Credentials{statement.value(0).toString().toStdString(), statement.value(1).toLongLong()};
+            }
+            return std::nullopt;
+        });
+    }
+
+    kj::Promise<std::optional<int64_t>> ticketEpoch(const std::string &uid) override {
+        return database.run([uid](DbConnection &c) -> std::optional<int64_t> {
+            auto &statement = c.exec(SQL_TICKET_EPOCH, {uid.c_str()});
+            if (statement.next()) {
+                return statement.value(0).toLongLong();
+            }
+            return std::nullopt;
+        });
+    }
+
+    kj::Promise<void> revokeTickets(const std::string &uid) override {
+        return database.run([uid](DbConnection &c) {
+            c.exec(SQL_REVOKE_TICKETS, {uid.c_str()});
+        });
+    }
+
+    kj::Promise<StoredProject> recordProject(const std::string &user, const std::string &name,
+                                             const std::string &path, const std::string &course) override {
+        return database.run([user, name, path, course](DbConnection &c) {
+            auto &statement = c.exec(SQL_RECORD_PROJECT, {
+                    user.c_str(), name.c_str(), user.c_str(), path.c_str(),
+                    course.empty() ? QVariant(QVariant::String) : QVariant(course.c_str())});
+            if (!statement.isActive()) {
+                return StoredProject{"cannot record project: " + statement.lastError().text().toStdString()};
+            }
+            if (!statement.next()) {
+                return StoredProject{"non-existent account"};
+            }
+            return StoredProject{"", statement.value(0).toInt()};
+        });
+    }
+
+    kj::Promise<std::pair<std::string, std::string>> projectPath(const std::string &user, const std::string &owner,
+                                                                 const std::string &pid) override {
+        return database.run([user, owner, pid](DbConnection &c) -> std::pair<std::string, std::string> {
+            if (owner != user && !isTeacher(c, user)) {
+                return {NOT_TEACHER, ""};
+            }
+            auto &statement = c.exec(SQL_PROJECT_PATH, {QString::fromStdString(owner), pid.c_str()});
+            if (!statement.next()) {
+                return {"no such project", ""};
+            }
+            if (statement.value(0).isNull()) {
+                return {"project has no stored files", ""};
+            }
+            return {"", statement.value(0).toString().toStdString()};
+        });
+    }
+
+    kj::Promise<std::pair<std::string, std::vector<CourseProject>>> courseProjects(
+            const std::string &user, const std::string &course) override {
+        using Found = std::pair<std::string, std::vector<CourseProject>>;
+        return database.run([user, course](DbConnection &c) -> Found {
+            if (!isTeacher(c, user)) {
+                return {NOT_TEACHER, {}};
+            }
+            auto &statement = c.exec(SQL_COURSE_PROJECTS, {course.c_str()});
+            std::vector<CourseProject> projects;
+            while (statement.next()) {
+                projects.push_back({statement.value(0).toString().toStdString(),
+                                    statement.value(1).toString().toStdString(),
+                                    statement.value(2).toString().toStdString(),
+                                    statement.value(3).toString().toStdString()});
+            }
+            return {"", std::move(projects)};
+        });
+    }
+
+    kj::Promise<std::optional<std::string>> removeProject(const std::string &user, const std::string &pid) override {
+        return database.run([user, pid](DbConnection &c) -> std::optional<std::string> {
+            auto &statement = c.exec(SQL_REMOVE_PROJECT, {QString::fromStdString(user), pid.c_str()});
+            if (!statement.next()) {
+                return std::nullopt;
+            }
+            return statement.value(0).toString().toStdString();
+        });
+    }
+
+    kj::Promise<std::shared_ptr<const ListingCache::Listing>> listProjects(const std::string &user,
+                                                                           EncodeListing encode) override {
+        return database.run([user, encode](DbConnection &c) {
+            return encode(fetchProjects(c.exec(SQL_LIST_PROJECTS, {user.c_str()})), std::nullopt);
+        });
+    }
+
+    kj::Promise<std::shared_ptr<const ListingCache::Listing>> listAll(
+            const std::string &course, uint32_t pageSize, const std::optional<ListPosition> &after,
+            EncodeListing encode) override {
+        return database.run([course, pageSize, after, encode](DbConnection &c) {
+            size_t variant = SQL_LIST_ALL;
+            QVariantList values;
+            if (!course.empty()) {
+                variant += SQL_LIST_ALL_COURSE - SQL_LIST_ALL;
+                values << course.c_str();
+            }
+            if (after) {
+                variant += SQL_LIST_ALL_AFTER - SQL_LIST_ALL;
+                values << after->pid << after->user.c_str();
+            }
+            // One extra row tells us whether there is a next page.
+            values << pageSize + 1;
+            auto &statement = c.exec(variant, values);
+            ProjectRows rows;
+            rows.reserve(pageSize);
+            QString lastUser;
+            std::optional<ListPosition> next;
+            while (statement.next()) {
+                if (rows.size() == pageSize) {
+                    next = ListPosition{rows.back().second, lastUser.toStdString()};
+                    break;
+                }
+                rows.emplace_back(statement.value(0).toString().toUtf8(), statement.value(1).toInt());
+                lastUser = statement.value(2).toString();
+            }
+            return encode(rows, next);
+        });
+    }
+
+    kj::Promise<std::pair<std::string, std::optional<GradedProject>>> judge(
+            const std::string &user, const std::string &owner, const std::string &pid, float score) override {
+        using Graded = std::pair<std::string, std::optional<GradedProject>>;
+        return database.run([user, owner, pid, score](DbConnection &c) -> Graded {
+            if (!isTeacher(c, user)) {
+                return {NOT_TEACHER, std::nullopt};
+            }
+            auto &statement = c.exec(SQL_JUDGE, {score, QString::fromStdString(owner), pid.c_str()});
+            if (!statement.next()) {
+                return {"no such project", std::nullopt};
+            }
+            return {"", GradedProject{QString::fromStdString(pid).toInt(), owner,
+                                      statement.value(0).toString().toStdString()}};
+        });
+    }
+
+    // Grades are applied with a single UPDATE joined against the unnested owner, id and score arrays,
+    // so a whole cohort costs one round trip.
+    kj::Promise<std::pair<std::string, std::vector<GradedProject>>> judgeMany(
+            const std::string &user, std::map<std::pair<std::string, int>, float> scores) override {
+        using Graded = std::pair<std::string, std::vector<GradedProject>>;
+        QStringList owners, pids, values;
+        for (const auto &[key, score]: scores) {
+            // Owners go in as quoted array elements, so quotes and backslashes in them are escaped.
+            QString owner = QString::fromStdString(key.first);
+            owner.replace('\\', "\\\\").replace('"', "\\\"");
+            owners << '"' + owner + '"';
+            pids << QString::number(key.second);
+            values << QString::number(score, 'g', 9);
+        }
+        return database.run([user, owners, pids, values](DbConnection &c) -> Graded {
+            if (!isTeacher(c, user)) {
+                return {NOT_TEACHER, {}};
+            }
+            auto &statement = c.exec(SQL_JUDGE_MANY, {"{" + owners.join(',') + "}", "{" + pids.join(',') + "}",
+                                                      "{" + values.join(',') + "}"});
+            if (!statement.isActive()) {
+                return {"cannot apply grades", {}};
+            }
+            std::vector<GradedProject> graded;
+            while (statement.next()) {
+                graded.push_back({statement.value(0).toInt(), statement.value(1).toString().toStdString(),
+                                  statement.value(2).toString().toStdString()});
+            }
+            return {"", std::move(graded)};
+        });
+    }
+
+    kj::Promise<bool> newCourse(const std::string &user, const std::string &id, const std::string &name) override {
+        return database.run([user, id, name](DbConnection &c) {
+            if (!isTeacher(c, user)) {
+                return false;
+            }
+            c.exec(SQL_NEW_COURSE, {id.c_str(), name.c_str(), QString::fromStdString(user)});
+            return true;
+        }).then([this, user, id, name](bool teacher) -> kj::Promise<bool> {
+            if (!teacher) {
+                return false;
+            }
+            auto owned = redis.command({"SADD", user + "Courses", id});
+            auto named = redis.command({"SADD", courseIdsKey(name), id});
+            return owned.then([named = kj::mv(named)](RedisReply) mutable {
+                return named.then([](RedisReply) {
+                    return true;
+                });
+            });
+        });
+    }
+
+    kj::Promise<std::string> deleteCourse(const std::string &user, const std::string &id) override {
+        // Resolves to an error message, or an empty one and the deleted course's name.
+        using Deleted = std::pair<std::string, std::string>;
+        return database.run([user, id](DbConnection &c) -> Deleted {
+            if (!isTeacher(c, user)) {
+                return {NOT_TEACHER, ""};
+            }
+            auto &statement = c.exec(SQL_DELETE_COURSE, {QString::fromStdString(id), QString::fromStdString(user)});
+            if (!statement.next()) {
+                return {"no such course", ""};
+            }
+            return {"", statement.value(1).toString().toStdString()};
+        }).then([this, user, id](Deleted deleted) -> kj::Promise<std::string> {
+            if (!deleted.first.empty()) {
+                return kj::mv(deleted.first);
+            }
+            auto removed = redis.command({"SREM", user + "Courses", id});
+            auto unnamed = redis.command({"SREM", courseIdsKey(deleted.second), id});
+            auto roster = redis.command({"DEL", rosterKey(id)});
+            return removed.then([unnamed = kj::mv(unnamed), roster = kj::mv(roster)](RedisReply) mutable {
+                return unnamed.then([roster = kj::mv(roster)](RedisReply) mutable {
+                    return roster.then([](RedisReply) {
+                        return std::string();
+                    });
+                });
+            });
+        });
+    }
+
+    // One round trip for the ids, then one for the SISMEMBERs of all their rosters.
+    kj::Promise<bool> isEnrolled(const std::string &course, const std::string &uid) override {
+        return redis.command({"SMEMBERS", courseIdsKey(course)}).then([this, uid](RedisReply ids) {
+            auto checks = kj::heapArrayBuilder<kj::Promise<bool>>(ids.elements.size());
+            for (const auto &id: ids.elements) {
+                checks.add(redis.command({"SISMEMBER", rosterKey(id.str), uid}).then([](RedisReply reply) {
+                    return reply.integer == 1;
+                }));
+            }
+            return kj::joinPromises(checks.finish()).then([](kj::Array<bool> enrolled) {
+                return std::find(enrolled.begin(), enrolled.end(), true) != enrolled.end();
+            });
+        });
+    }
+
+    kj::Promise<std::pair<std::string, uint32_t>> enroll(const std::string &user, const std::string &course,
+                                                         std::vector<std::string_view> uids) override {
+        return changeRoster("SADD", user, course, std::move(uids));
+    }
+
+    kj::Promise<std::pair<std::string, uint32_t>> unenroll(const std::string &user, const std::string &course,
+                                                           std::vector<std::string_view> uids) override {
+        return changeRoster("SREM", user, course, std::move(uids));
+    }
+
+private:
+    // The write and its EXPIRE go out together and cost one round trip.
+    kj::Promise<void> refresh(const std::string &key, kj::Promise<RedisReply> written) {
+        auto expiry = redis.command({"EXPIRE", key, std::to_string(SESSION_TTL.count())});
+        return written.then([expiry = kj::mv(expiry)](RedisReply) mutable {
+            return expiry.ignoreResult();
+        });
+    }
+
+    // Only the courses named `course` that `user` teaches are changed: their ids are the intersection
+    // of the name's ids with the teacher's. Each roster then takes a single variadic SADD/SREM, so any
+    // number of uids costs one more round trip.
+    kj::Promise<std::pair<std::string, uint32_t>> changeRoster(std::string_view verb, const std::string &user,
+                                                               const std::string &course,
+                                                               std::vector<std::string_view> uids) {
+        using Changed = std::pair<std::string, uint32_t>;
+        return redis.command({"SINTER", courseIdsKey(course), user + "Courses"}).then(
+                [this, verb, user, uids = std::move(uids)](RedisReply ids) mutable -> kj::Promise<Changed> {
+            if (ids.elements.empty()) {
+                return database.run([user](DbConnection &c) {
+                    return Changed{isTeacher(c, user) ? "no such course" : NOT_TEACHER, 0};
+                });
+            }
+            if (uids.empty()) {
+                return Changed{"", 0};
+            }
+            auto changes = kj::heapArrayBuilder<kj::Promise<uint32_t>>(ids.elements.size());
+            for (const auto &id: ids.elements) {
+                std::string key = rosterKey(id.str);
+                std::vector<std::string_view> args{verb, key};
+                args.insert(args.end(), uids.begin(), uids.end());
+                changes.add(redis.command(kj::arrayPtr(args.data(), args.size())).then([](RedisReply reply) {
+                    return static_cast<uint32_t>(reply.integer);
+                }));
+            }
+            return kj::joinPromises(changes.finish()).then([](kj::Array<uint32_t> counts) {
+                uint32_t changed = 0;
+                for (auto count: counts) {
+                    changed += count;
+                }
+                return Changed{"", changed};
+            });
+        });
+    }
+
+    static bool isTeacher(DbConnection &c, const std::string &user) {
+        return c.exec(SQL_IS_TEACHER, {QString::fromStdString(user)}).next();
+    }
+
+    // Catalog statements are forward-only, so the driver streams rows instead of buffering a
+    // scrollable result.
+    static ProjectRows fetchProjects(QSqlQuery &statement) {
+        ProjectRows rows;
+        while (statement.next()) {
+            rows.emplace_back(statement.value(0).toString().toUtf8(), statement.value(1).toInt());
+        }
+        return rows;
+    }
+
+    DbPool &database;
+    AsyncRedis redis;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_POSTGRESSTORAGE_H
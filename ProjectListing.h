@@ -0,0 +1,60 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_PROJECTLISTING_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_PROJECTLISTING_H
+
+#include "ListingCache.h"
+#include "Storage.h"
+#include "system.capnp.h"
+#include <capnp/message.h>
+#include <kj/array.h>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+// listAll pages are keyed on (pid, user), since pids are only unique per user. The cursor handed
+// to clients is that pair: four little-endian bytes of pid followed by the user id.
+
+inline std::string encodeCursor(int pid, const std::string &user) {
+    std::string cursor(4, '\0');
+    for (int i = 0; i != 4; ++i) {
+        cursor[i] = static_cast<char>((static_cast<uint32_t>(pid) >> (8 * i)) & 0xff);
+    }
+    return cursor + user;
+}
+
+inline bool decodeCursor(kj::ArrayPtr<const kj::byte> cursor, int &pid, std::string &user) {
+    if (cursor.size() < 4) {
+        return false;
+    }
+    uint32_t raw = 0;
+    for (int i = 0; i != 4; ++i) {
+        raw |= static_cast<uint32_t>(cursor[i]) << (8 * i);
+    }
+    pid = static_cast<int>(raw);
+    user.assign(reinterpret_cast<const char *>(cursor.begin()) + 4, cursor.size() - 4);
+    return true;
+}
+
+// Listings are encoded once, by the storage backend, into the form the cache keeps. The message
+// is sized up front from the rows, and names go in straight from their UTF-8 bytes.
+inline std::shared_ptr<const ListingCache::Listing> encodeProjects(const ProjectRows &rows,
+                                                                   const std::optional<ListPosition> &next) {
+    // Root pointer, Either, list tag and three words per Project, plus the names.
+    size_t words = 4 + 3 * rows.size();
+    for (const auto &row: rows) {
+        words += row.first.size() / sizeof(::capnp::word) + 1;
+    }
+    auto listing = std::make_shared<ListingCache::Listing>(words);
+    auto ls = listing->message.get().initRoot<Either<BoxedText, ::capnp::List<Project>>>().initRight(rows.size());
+    for (unsigned i = 0; i != rows.size(); ++i) {
+        ls[i].setName(::capnp::Text::Reader(rows[i].first.constData(), rows[i].first.size()));
+        ls[i].setId(rows[i].second);
+    }
+    listing->message.seal();
+    if (next) {
+        listing->nextCursor = encodeCursor(next->pid, next->user);
+    }
+    return listing;
+}
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_PROJECTLISTING_H
@@ -0,0 +1,133 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_STORAGE_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_STORAGE_H
+
+#include "ListingCache.h"
+#include <QByteArray>
+#include <kj/async.h>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Outcome of storing an upload: an error message, or an empty one and the new project id.
+struct StoredProject {
+    std::string error;
+    int id = -1;
+};
+
+using ProjectRows = std::vector<std::pair<QByteArray, int>>; // UTF-8 name, id
+
+// A place in the listAll order, which is by (pid, user) since pids are only unique per user.
+struct ListPosition {
+    int pid;
+    std::string user;
+};
+
+// Turns listing rows into the form the listing cache keeps. `next` is where the following page
+// starts, if there is one. Backends call it wherever the rows become available, so the Postgres
+// backend encodes on its database worker rather than on the event loop.
+using EncodeListing = std::shared_ptr<const ListingCache::Listing> (*)(const ProjectRows &rows,
+                                                                       const std::optional<ListPosition> &next);
+
+// A stored project of a course, as exported.
+struct CourseProject {
+    std::string owner;
+    std::string pid;
+    std::string name;
+    std::string path; // relative to the owner's tree
+};
+
+// A project whose score changed, identifying the listings that show it.
+struct GradedProject {
+    int pid;
+    std::string owner;
+    std::string course;
+};
+
+// What a login is checked against, read together so a ticket issued for it carries the epoch the
+// account had when the password was verified.
+struct Credentials {
+    std::string passwordHash; // SHA-256 hex
+    int64_t ticketEpoch;
+};
+
+constexpr const char *NOT_TEACHER = "permisson denied: you're not a teacher";
+
+// Idle time after which a session is forgotten; every write to it starts the period again.
+constexpr std::chrono::seconds SESSION_TTL(1200);
+
+// Accounts, projects, courses, rosters and sessions, as the RPC handlers see them. Every event-loop
+// thread opens its own Storage and only calls it from that thread; backends that share state
+// between threads synchronise it themselves. Operations that are teachers-only take the calling
+// user and report NOT_TEACHER for anyone else.
+class Storage {
+public:
+    virtual ~Storage() = default;
+
+    // Sessions: the key pair handed out by initiateSession and, once logged in, the user.
+    virtual kj::Promise<void> createSession(const std::string &fingerprint, const QByteArray &pubkey,
+                                            const QByteArray &privkey) = 0;
+    // Resolves to nothing unless the session exists and holds a key pair.
+    virtual kj::Promise<std::optional<QByteArray>> privateKey(const std::string &fingerprint) = 0;
+    virtual kj::Promise<void> setLogin(const std::string &fingerprint, const std::string &uid) = 0;
+    virtual kj::Promise<std::optional<std::string>> loginOf(const std::string &fingerprint) = 0;
+    virtual kj::Promise<void> endSession(const std::string &fingerprint) = 0;
+
+    // Nothing for an unknown account.
+    virtual kj::Promise<std::optional<Credentials>> credentials(const std::string &uid) = 0;
+    // Resumption tickets carry the epoch of their account at login and are only honoured while it is
+    // unchanged; revoking bumps it. Resolves to nothing for an unknown account.
+    virtual kj::Promise<std::optional<int64_t>> ticketEpoch(const std::string &uid) = 0;
+    virtual kj::Promise<void> revokeTickets(const std::string &uid) = 0;
+
+    // Allocates the user's next project id and records the project under it.
+    virtual kj::Promise<StoredProject> recordProject(const std::string &user, const std::string &name,
+                                                     const std::string &path, const std::string &course) = 0;
+    // Resolves to an error message, or an empty one and the path of the project's files. Only
+    // teachers may look up projects owned by someone else.
+    virtual kj::Promise<std::pair<std::string, std::string>> projectPath(const std::string &user,
+                                                                         const std::string &owner,
+                                                                         const std::string &pid) = 0;
+    // Every project of `course` with stored files, ordered by owner and pid. Teachers only.
+    virtual kj::Promise<std::pair<std::string, std::vector<CourseProject>>> courseProjects(
+            const std::string &user, const std::string &course) = 0;
+    // Resolves to the course of the removed project, or nothing if there was no such project.
+    virtual kj::Promise<std::optional<std::string>> removeProject(const std::string &user,
+                                                                  const std::string &pid) = 0;
+    virtual kj::Promise<std::shared_ptr<const ListingCache::Listing>> listProjects(const std::string &user,
+                                                                                   EncodeListing encode) = 0;
+    // Up to `pageSize` projects after `after`, in listAll order, optionally only those of `course`.
+    virtual kj::Promise<std::shared_ptr<const ListingCache::Listing>> listAll(
+            const std::string &course, uint32_t pageSize, const std::optional<ListPosition> &after,
+            EncodeListing encode) = 0;
+    // Scores `owner`'s project `pid`. Resolves to an error message, or an empty one and the graded
+    // project. Teachers only.
+    virtual kj::Promise<std::pair<std::string, std::optional<GradedProject>>> judge(
+            const std::string &user, const std::string &owner, const std::string &pid, float score) = 0;
+    // Applies all scores, keyed on (owner, pid), at once. Resolves to an error message, or an empty one
+    // and the projects that were graded. Teachers only.
+    virtual kj::Promise<std::pair<std::string, std::vector<GradedProject>>> judgeMany(
+            const std::string &user, std::map<std::pair<std::string, int>, float> scores) = 0;
+
+    // Resolves to false if `user` is not a teacher.
+    virtual kj::Promise<bool> newCourse(const std::string &user, const std::string &id, const std::string &name) = 0;
+    // Deletes a course of `user`'s, with its roster. Resolves to an error message, or an empty one.
+    virtual kj::Promise<std::string> deleteCourse(const std::string &user, const std::string &id) = 0;
+
+    // Rosters belong to course ids; clients name courses, so each of these resolves the name first.
+    // Whether `uid` is on the roster of a course named `course`.
+    virtual kj::Promise<bool> isEnrolled(const std::string &course, const std::string &uid) = 0;
+    // Change the rosters of the courses named `course` that `user` teaches. Resolve to an error
+    // message, or an empty one and how many of `uids` actually joined or left.
+    virtual kj::Promise<std::pair<std::string, uint32_t>> enroll(const std::string &user, const std::string &course,
+                                                                 std::vector<std::string_view> uids) = 0;
+    virtual kj::Promise<std::pair<std::string, uint32_t>> unenroll(const std::string &user, const std::string &course,
+                                                                   std::vector<std::string_view> uids) = 0;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_STORAGE_H
@@ -0,0 +1,107 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_TICKET_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_TICKET_H
+
+#include "SHA256.h"
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+
+// Session resumption tickets: "<uid>\n<epoch>\n<expiry in unix seconds>\n" followed by the HMAC-SHA256
+// of that text under a server-side key. A valid ticket proves a past login, so resuming costs two
+// hashes and a lookup of the account's ticket epoch instead of RSA key generation, RSA decryption and
+// a password check. Tickets renewed by resuming keep the expiry of the login they stem from, and
+// bumping the account's epoch revokes all of them.
+// The key only lives in memory unless one is supplied, so tickets do not survive a restart then.
+class TicketIssuer {
+public:
+    struct Ticket {
+        std::string uid;
+        int64_t epoch;
+        int64_t expiry;
+    };
+
+    TicketIssuer(std::string key, std::chrono::seconds lifetime) : key(std::move(key)), lifetime(lifetime) {
+        if (this->key.empty()) {
+            std::random_device r;
+            for (int i = 0; i != 32; ++i) {
+                this->key += static_cast<char>(r() & 0xff);
+            }
+        }
+    }
+
+    // A ticket for a fresh login, valid for the configured lifetime.
+    std::string issue(const std::string &uid, int64_t epoch) const {
+        auto expiry = std::chrono::duration_cast<std::chrono::seconds>(
+                (std::chrono::system_clock::now() + lifetime).time_since_epoch()).count();
+        return issue({uid, epoch, expiry});
+    }
+
+    std::string issue(const Ticket &ticket) const {
+        std::string payload = ticket.uid + "\n" + std::to_string(ticket.epoch) + "\n" + std::to_string(ticket.expiry)
+                              + "\n";
+        return payload + hmac(payload);
+    }
+
+    // What the ticket says, if it is authentic and has not expired. Whether its epoch is still the
+    // account's is up to the caller.
+    std::optional<Ticket> verify(const std::string &ticket) const {
+        if (ticket.size() <= MAC_SIZE) {
+            return std::nullopt;
+        }
+        std::string payload = ticket.substr(0, ticket.size() - MAC_SIZE);
+        std::string mac = hmac(payload);
+        unsigned char diff = 0;
+        for (size_t i = 0; i != MAC_SIZE; ++i) {
+            diff |= static_cast<unsigned char>(mac[i] ^ ticket[payload.size() + i]);
+        }
+        size_t first = payload.find('\n');
+        size_t second = first == std::string::npos ? first : payload.find('\n', first + 1);
+        if (diff != 0 || second == std::string::npos || payload.back() != '\n') {
+            return std::nullopt;
+        }
+        Ticket parsed{payload.substr(0, first)};
+        try {
+            parsed.epoch = std::stoll(payload.substr(first + 1, second - first - 1));
+            parsed.expiry = std::stoll(payload.substr(second + 1));
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+        auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        if (now >= parsed.expiry) {
+            return std::nullopt;
+        }
+        return parsed;
+    }
+
+private:
+    static constexpr size_t MAC_SIZE = 32;
+    static constexpr size_t BLOCK = 64;
+
+    static std::string sha256(const std::string &data) {
+        SHA256 sha;
+        sha.update(data);
+        auto *digest = sha.digest();
+        std::string raw(reinterpret_cast<const char *>(digest), MAC_SIZE);
+        delete[] digest;
+        return raw;
+    }
+
+    std::string hmac(const std::string &message) const {
+        std::string k = key.size() > BLOCK ? sha256(key) : key;
+        k.resize(BLOCK, '\0');
+        std::string inner(BLOCK, '\0'), outer(BLOCK, '\0');
+        for (size_t i = 0; i != BLOCK; ++i) {
+            inner[i] = static_cast<char>(k[i] ^ 0x36);
+            outer[i] = static_cast<char>(k[i] ^ 0x5c);
+        }
+        return sha256(outer + sha256(inner + message));
+    }
+
+    std::string key;
+    const std::chrono::seconds lifetime;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_TICKET_H
@@ -0,0 +1,99 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_WORKERPOOL_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_WORKERPOOL_H
+
+#include <kj/async.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads that each run their own kj event loop. Work is handed over with Executor::executeAsync(),
+// so the caller gets an ordinary promise on its own loop and keeps serving other events meanwhile.
+// The calling thread must have a kj event loop as well.
+class WorkerPool {
+public:
+    using Hook = std::function<void(size_t)>;
+
+    // `setup` and `teardown` run on each worker thread, before it accepts work and after it stops.
+    explicit WorkerPool(size_t n, Hook setup = {}, Hook teardown = {})
+            : setup(std::move(setup)), teardown(std::move(teardown)) {
+        if (n == 0) {
+            n = 1;
+        }
+        for (size_t i = 0; i != n; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i != n; ++i) {
+            workers[i]->thread = std::thread([this, i] { loop(i); });
+        }
+        std::unique_lock lock(mutex);
+        started.wait(lock, [this] { return ready == workers.size(); });
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    ~WorkerPool() {
+        for (auto &w: workers) {
+            w->executor->executeSync([&w] { w->stop->fulfill(); });
+        }
+        for (auto &w: workers) {
+            w->thread.join();
+        }
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // Runs `func(workerIndex)` on the next worker in round-robin order and returns its result.
+    template<typename Func>
+    auto run(Func &&func) {
+        size_t index = next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        return workers[index]->executor->executeAsync([index, func = kj::fwd<Func>(func)]() mutable {
+            return func(index);
+        });
+    }
+
+private:
+    struct Worker {
+        std::thread thread;
+        const kj::Executor *executor = nullptr;
+        kj::PromiseFulfiller<void> *stop = nullptr;
+    };
+
+    void loop(size_t i) {
+        kj::EventLoop eventLoop;
+        kj::WaitScope scope(eventLoop);
+        auto paf = kj::newPromiseAndFulfiller<void>();
+        if (setup) {
+            setup(i);
+        }
+        {
+            std::lock_guard lock(mutex);
+            workers[i]->executor = &kj::getCurrentThreadExecutor();
+            workers[i]->stop = paf.fulfiller.get();
+            ++ready;
+        }
+        started.notify_all();
+        paf.promise.wait(scope);
+        if (teardown) {
+            teardown(i);
+        }
+    }
+
+    Hook setup;
+    Hook teardown;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next{0};
+
+    std::mutex mutex;
+    std::condition_variable started;
+    size_t ready = 0;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_WORKERPOOL_H
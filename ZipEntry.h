@@ -0,0 +1,99 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ZIPENTRY_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ZIPENTRY_H
+
+#include <cstdint>
+#include <string>
+
+// Header records of a zip archive written strictly front to back. Entries are either stored or
+// deflated. No zip64: sizes and offsets must fit in 32 bits, at most MAX_ENTRIES entries.
+struct ZipEntry {
+    static constexpr uint16_t STORED = 0;
+    static constexpr uint16_t DEFLATED = 8;
+    static constexpr uint16_t DATA_DESCRIPTOR = 0x0008; // sizes and CRC follow the data
+    static constexpr uint16_t UTF8_NAMES = 0x0800;
+    static constexpr uint64_t MAX_SIZE = 0xffffffff;
+    static constexpr size_t MAX_ENTRIES = 0xffff;
+
+    std::string name;
+    uint16_t method = STORED;
+    uint16_t flags = UTF8_NAMES;
+    uint32_t crc = 0;
+    uint64_t compressedSize = 0;
+    uint64_t size = 0;
+    uint64_t offset = 0; // of the local header
+
+    // With DATA_DESCRIPTOR set, CRC and sizes are left zero here and written by dataDescriptor().
+    std::string localHeader() const {
+        bool deferred = flags & DATA_DESCRIPTOR;
+        std::string h;
+        put32(h, 0x04034b50);
+        put16(h, 20);   // version needed
+        put16(h, flags);
+        put16(h, method);
+        put16(h, 0);    // time
+        put16(h, 0x21); // date: 1980-01-01
+        put32(h, deferred ? 0 : crc);
+        put32(h, deferred ? 0 : static_cast<uint32_t>(compressedSize));
+        put32(h, deferred ? 0 : static_cast<uint32_t>(size));
+        put16(h, static_cast<uint16_t>(name.size()));
+        put16(h, 0);
+        return h + name;
+    }
+
+    std::string dataDescriptor() const {
+        std::string h;
+        put32(h, 0x08074b50);
+        put32(h, crc);
+        put32(h, static_cast<uint32_t>(compressedSize));
+        put32(h, static_cast<uint32_t>(size));
+        return h;
+    }
+
+    std::string centralHeader() const {
+        std::string h;
+        put32(h, 0x02014b50);
+        put16(h, 0x0314); // made by: unix, 2.0
+        put16(h, 20);
+        put16(h, flags);
+        put16(h, method);
+        put16(h, 0);
+        put16(h, 0x21);
+        put32(h, crc);
+        put32(h, static_cast<uint32_t>(compressedSize));
+        put32(h, static_cast<uint32_t>(size));
+        put16(h, static_cast<uint16_t>(name.size()));
+        put16(h, 0); // extra
+        put16(h, 0); // comment
+        put16(h, 0); // disk
+        put16(h, 0); // internal attributes
+        put32(h, 0100644u << 16);
+        put32(h, static_cast<uint32_t>(offset));
+        return h + name;
+    }
+
+    static std::string endOfCentralDirectory(size_t entries, uint64_t centralSize, uint64_t centralOffset) {
+        std::string h;
+        put32(h, 0x06054b50);
+        put16(h, 0);
+        put16(h, 0);
+        put16(h, static_cast<uint16_t>(entries));
+        put16(h, static_cast<uint16_t>(entries));
+        put32(h, static_cast<uint32_t>(centralSize));
+        put32(h, static_cast<uint32_t>(centralOffset));
+        put16(h, 0);
+        return h;
+    }
+
+private:
+    static void put16(std::string &out, uint16_t x) {
+        out += static_cast<char>(x & 0xff);
+        out += static_cast<char>(x >> 8);
+    }
+
+    static void put32(std::string &out, uint32_t x) {
+        put16(out, static_cast<uint16_t>(x & 0xffff));
+        put16(out, static_cast<uint16_t>(x >> 16));
+    }
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ZIPENTRY_H
@@ -0,0 +1,185 @@
+#ifndef _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ZIPPIPELINE_H
+#define _GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ZIPPIPELINE_H
+
+#include "WorkerPool.h"
+#include "ZipEntry.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <kj/async.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Builds a deflated zip archive on a pool of threads and hands it out in order while later parts
+// are still being compressed, so neither the archive nor a temporary file ever exists as a whole.
+// Files are cut into blocks that are deflated independently, pigz-style: every block but a file's
+// last ends with a sync flush, which makes the concatenated blocks one valid deflate stream. Block
+// CRCs are combined with crc32_combine(). Only a bounded window of blocks is in flight at a time.
+class ZipPipeline {
+public:
+    struct File {
+        QString source;
+        std::string name; // inside the archive
+    };
+
+    // Receives the archive piece by piece; the returned promise applies back-pressure.
+    using Emit = std::function<kj::Promise<void>(std::string)>;
+
+    explicit ZipPipeline(size_t threads) : pool(threads) {}
+
+    // Resolves to an error message, or an empty string once the whole archive has been emitted.
+    kj::Promise<std::string> send(std::vector<File> files, Emit emit) {
+        if (files.size() > ZipEntry::MAX_ENTRIES) {
+            return std::string("too many files for a zip archive");
+        }
+        auto job = kj::heap<Job>(pool, std::move(files), std::move(emit));
+        auto &ref = *job;
+        return ref.start().attach(kj::mv(job));
+    }
+
+private:
+    static constexpr qint64 BLOCK = 1 << 20;
+
+    struct Block {
+        size_t file;
+        qint64 offset;
+        bool last;
+    };
+
+    struct Deflated {
+        std::string error;
+        std::string data;
+        uint32_t crc = 0;
+        uint64_t size = 0;
+    };
+
+    static Deflated deflateBlock(const QString &source, qint64 offset, bool last) {
+        Deflated out;
+        QFile file(source);
+        if (!file.open(QIODevice::ReadOnly) || !file.seek(offset)) {
+            out.error = "cannot read " + source.toStdString();
+            return out;
+        }
+        QByteArray input = file.read(BLOCK);
+        out.size = input.size();
+        out.crc = ::crc32(::crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef *>(input.constData()), input.size());
+        z_stream z{};
+        if (::deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            out.error = "cannot initialise deflate";
+            return out;
+        }
+        // deflateBound() does not count the empty stored block a sync flush appends.
+        out.data.resize(::deflateBound(&z, input.size()) + 16);
+        z.next_in = reinterpret_cast<Bytef *>(input.data());
+        z.avail_in = static_cast<uInt>(input.size());
+        z.next_out = reinterpret_cast<Bytef *>(out.data.data());
+        z.avail_out = static_cast<uInt>(out.data.size());
+        int result = ::deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (result != (last ? Z_STREAM_END : Z_OK) || z.avail_in != 0 || z.avail_out == 0) {
+            out.error = "cannot compress " + source.toStdString();
+        }
+        out.data.resize(out.data.size() - z.avail_out);
+        ::deflateEnd(&z);
+        return out;
+    }
+
+    class Job {
+    public:
+        Job(WorkerPool &pool, std::vector<File> files, Emit emit)
+                : pool(pool), files(std::move(files)), emit(std::move(emit)), window(2 * pool.size()) {
+            for (size_t i = 0; i != this->files.size(); ++i) {
+                qint64 size = QFileInfo(this->files[i].source).size();
+                for (qint64 at = 0;; at += BLOCK) {
+                    bool last = at + BLOCK >= size;
+                    blocks.push_back({i, at, last});
+                    if (last) {
+                        break;
+                    }
+                }
+            }
+            entries.resize(this->files.size());
+        }
+
+        kj::Promise<std::string> start() {
+            while (started < blocks.size() && inFlight.size() < window) {
+                launch();
+            }
+            return next(0);
+        }
+
+    private:
+        void launch() {
+            const Block &b = blocks[started++];
+            inFlight.push_back(pool.run([source = files[b.file].source, offset = b.offset, last = b.last](size_t) {
+                return deflateBlock(source, offset, last);
+            }));
+        }
+
+        kj::Promise<std::string> next(size_t i) {
+            if (i == blocks.size()) {
+                return finish();
+            }
+            auto deflated = kj::mv(inFlight.front());
+            inFlight.pop_front();
+            if (started < blocks.size()) {
+                launch();
+            }
+            return deflated.then([this, i](Deflated d) -> kj::Promise<std::string> {
+                if (!d.error.empty()) {
+                    return d.error;
+                }
+                const Block &b = blocks[i];
+                auto &entry = entries[b.file];
+                std::string piece;
+                if (b.offset == 0) {
+                    entry = {files[b.file].name, ZipEntry::DEFLATED, ZipEntry::UTF8_NAMES | ZipEntry::DATA_DESCRIPTOR,
+                             d.crc, 0, 0, written};
+                    piece = entry.localHeader();
+                } else {
+                    entry.crc = ::crc32_combine(entry.crc, d.crc, static_cast<z_off_t>(d.size));
+                }
+                entry.compressedSize += d.data.size();
+                entry.size += d.size;
+                piece += d.data;
+                if (b.last) {
+                    piece += entry.dataDescriptor();
+                    central += entry.centralHeader();
+                }
+                written += piece.size();
+                if (written > ZipEntry::MAX_SIZE || entry.size > ZipEntry::MAX_SIZE) {
+                    return std::string("archive too large for a zip file");
+                }
+                return emit(std::move(piece)).then([this, i] {
+                    return next(i + 1);
+                });
+            });
+        }
+
+        kj::Promise<std::string> finish() {
+            std::string tail = central + ZipEntry::endOfCentralDirectory(files.size(), central.size(), written);
+            return emit(std::move(tail)).then([] {
+                return std::string();
+            });
+        }
+
+        WorkerPool &pool;
+        const std::vector<File> files;
+        Emit emit;
+        const size_t window;
+        std::vector<Block> blocks;
+        std::vector<ZipEntry> entries;
+        std::deque<kj::Promise<Deflated>> inFlight;
+        size_t started = 0;
+        std::string central;
+        uint64_t written = 0;
+    };
+
+    WorkerPool pool;
+};
+
+#endif //_GRADUATE_DESIGN_MANAGEMENT_SYSTEM_ZIPPIPELINE_H
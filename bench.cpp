@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <qrsaencryption.h>
+#include "CalcSHA256.h"
+#include "Fingerprint.h"
+#include "ProjectListing.h"
+#include "third_party/Base64.h"
+
+// Microbenchmarks for the primitives every login and listing runs. Results go to stdout as JSON
+// unless another --benchmark_format is given, so the output of two builds can be diffed directly,
+// e.g. with tools/compare.py from google/benchmark.
+
+// Hashing a password, including the digest allocation and the hex conversion.
+static void BM_CalcSHA256(benchmark::State &state) {
+    std::string password(static_cast<size_t>(state.range(0)), 'p');
+    for (auto _: state) {
+        benchmark::DoNotOptimize(CalcSHA256(password)());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CalcSHA256)->Arg(16)->Arg(64)->Arg(1024);
+
+static void BM_RsaKeygen(benchmark::State &state) {
+    QRSAEncryption e(QRSAEncryption::Rsa::RSA_2048);
+    for (auto _: state) {
+        QByteArray pub, priv;
+        e.generatePairKey(pub, priv);
+        benchmark::DoNotOptimize(priv);
+    }
+}
+BENCHMARK(BM_RsaKeygen)->Unit(benchmark::kMillisecond);
+
+// One key pair shared by the encode and decode benchmarks; generating it is measured above.
+static const std::pair<QByteArray, QByteArray> &keyPair() {
+    static const auto pair = [] {
+        QByteArray pub, priv;
+        QRSAEncryption(QRSAEncryption::Rsa::RSA_2048).generatePairKey(pub, priv);
+        return std::make_pair(pub, priv);
+    }();
+    return pair;
+}
+
+// What a client does with its password at login.
+static void BM_RsaEncode(benchmark::State &state) {
+    QRSAEncryption e(QRSAEncryption::Rsa::RSA_2048);
+    QByteArray password(32, 'p');
+    for (auto _: state) {
+        benchmark::DoNotOptimize(e.encode(password, keyPair().first));
+    }
+}
+BENCHMARK(BM_RsaEncode)->Unit(benchmark::kMicrosecond);
+
+// What the server does with it.
+static void BM_RsaDecode(benchmark::State &state) {
+    QRSAEncryption e(QRSAEncryption::Rsa::RSA_2048);
+    QByteArray encoded = e.encode(QByteArray(32, 'p'), keyPair().first);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(e.decode(encoded, keyPair().second));
+    }
+}
+BENCHMARK(BM_RsaDecode)->Unit(benchmark::kMicrosecond);
+
+static std::string randomBytes(size_t n) {
+    std::mt19937 gen(42);
+    std::string bytes(n, '\0');
+    for (auto &b: bytes) {
+        b = static_cast<char>(gen() & 0xff);
+    }
+    return bytes;
+}
+
+static void BM_Base64Encode(benchmark::State &state) {
+    std::string data = randomBytes(static_cast<size_t>(state.range(0)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(macaron::Base64::Encode(data));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Encode)->Arg(64)->Arg(4096)->Arg(1 << 20);
+
+static void BM_Base64Decode(benchmark::State &state) {
+    std::string encoded = macaron::Base64::Encode(randomBytes(static_cast<size_t>(state.range(0))));
+    for (auto _: state) {
+        std::string out;
+        benchmark::DoNotOptimize(macaron::Base64::Decode(encoded, out));
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Decode)->Arg(64)->Arg(4096)->Arg(1 << 20);
+
+// Includes reading std::random_device, which initiateSession does once per fingerprint.
+static void BM_Fingerprint(benchmark::State &state) {
+    std::random_device r;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(generateFingerprint(r));
+    }
+}
+BENCHMARK(BM_Fingerprint);
+
+static ProjectRows projectRows(size_t n) {
+    ProjectRows rows;
+    rows.reserve(n);
+    for (size_t i = 0; i != n; ++i) {
+        rows.emplace_back("graduate design project " + QByteArray::number(static_cast<qulonglong>(i)),
+                          static_cast<int>(i));
+    }
+    return rows;
+}
+
+// Encoding a List(Project) listing as the storage backends do on a cache miss.
+static void BM_EncodeProjects(benchmark::State &state) {
+    auto rows = projectRows(static_cast<size_t>(state.range(0)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(encodeProjects(rows, std::nullopt));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncodeProjects)->Arg(10)->Arg(1000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+// Copying an encoded listing into a reply sized to hold it, as every cache hit does.
+static void BM_CopyListing(benchmark::State &state) {
+    auto listing = encodeProjects(projectRows(static_cast<size_t>(state.range(0))), std::nullopt);
+    for (auto _: state) {
+        ::capnp::SegmentArrayMessageReader reader(listing->message.segments());
+        ::capnp::MallocMessageBuilder reply(listing->message.sizeInWords() + 8);
+        reply.setRoot(reader.getRoot<Either<BoxedText, ::capnp::List<Project>>>());
+        benchmark::DoNotOptimize(reply.getSegmentsForOutput().size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CopyListing)->Arg(10)->Arg(1000)->Arg(100000)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char *argv[]) {
+    std::vector<char *> args(argv, argv + argc);
+    std::string json = "--benchmark_format=json";
+    if (std::none_of(args.begin() + 1, args.end(), [](const char *arg) {
+        return std::string_view(arg).starts_with("--benchmark_format");
+    })) {
+        args.push_back(json.data());
+    }
+    int n = static_cast<int>(args.size());
+    benchmark::Initialize(&n, args.data());
+    if (benchmark::ReportUnrecognizedArguments(n, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include "Client.h"
+#include "Histogram.h"
+#include <QuaZip-Qt5-1.3/quazip/JlCompress.h>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum Op {
+    SESSION, // initiateSession + login
+    UPLOAD,
+    LIST_PROJECT,
+    LIST_ALL,
+    JUDGE,
+    OP_COUNT
+};
+
+const char *const OP_NAMES[OP_COUNT] = {"session", "upload", "listProject", "listAll", "judge"};
+
+struct Options {
+    std::string host;
+    int port;
+    std::string user;
+    std::string password;
+    std::string course;
+    std::string projectId;
+    std::string projectOwner;
+    std::string archive;
+    std::array<unsigned, OP_COUNT> weights;
+    double rate; // total ops/s over all connections, 0 for closed loop
+    std::chrono::seconds duration;
+};
+
+struct Stats {
+    std::array<Histogram, OP_COUNT> latency; // microseconds
+    std::array<uint64_t, OP_COUNT> errors{};
+};
+
+// Parses "session=1,upload=1,listProject=10" into per-op weights.
+bool parseMix(const QString &mix, std::array<unsigned, OP_COUNT> &weights) {
+    weights.fill(0);
+    for (const auto &item: mix.split(',', Qt::SkipEmptyParts)) {
+        auto kv = item.split('=');
+        int op = 0;
+        while (op != OP_COUNT && kv[0].trimmed() != OP_NAMES[op]) {
+            ++op;
+        }
+        if (op == OP_COUNT || kv.size() != 2) {
+            return false;
+        }
+        weights[op] = kv[1].toUInt();
+    }
+    return true;
+}
+
+// Writes `bytes` of random data into a directory and zips it once, so uploads measure the server
+// rather than client-side compression.
+std::string prepareArchive(const QTemporaryDir &dir, qint64 bytes) {
+    QString tree = dir.filePath("payload");
+    QDir().mkpath(tree);
+    QFile payload(tree + "/payload.bin");
+    payload.open(QIODevice::WriteOnly);
+    std::mt19937_64 gen(42);
+    std::vector<uint64_t> block(8192);
+    for (qint64 written = 0; written < bytes;) {
+        for (auto &x: block) {
+            x = gen();
+        }
+        qint64 n = std::min<qint64>(bytes - written, block.size() * sizeof(uint64_t));
+        payload.write(reinterpret_cast<const char *>(block.data()), n);
+        written += n;
+    }
+    payload.close();
+    QString archive = dir.filePath("payload.zip");
+    JlCompress::compressDir(archive, tree);
+    return archive.toStdString();
+}
+
+void connection(const Options &options, unsigned id, unsigned connections, Stats &stats) {
+    try {
+        Client c(options.host, options.port);
+        if (!c.login(options.user, options.password)) {
+            stats.errors[SESSION]++;
+            return;
+        }
+        std::mt19937 gen(id);
+        std::discrete_distribution<int> pick(options.weights.begin(), options.weights.end());
+        std::string remotePath = "loadgen/" + std::to_string(id);
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        auto deadline = start + options.duration;
+        // Open loop: each connection issues its share of the rate on a fixed schedule, and latency is
+        // measured from the scheduled start so a stalled server is not hidden (coordinated omission).
+        std::chrono::nanoseconds interval{0};
+        if (options.rate > 0) {
+            interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 * connections / options.rate));
+        }
+        for (uint64_t n = 0;; ++n) {
+            auto begin = clock::now();
+            if (interval.count() > 0) {
+                begin = start + n * interval;
+                std::this_thread::sleep_until(begin);
+            }
+            if (begin >= deadline) {
+                break;
+            }
+            int op = pick(gen);
+            std::string err;
+            std::vector<ProjectEntry> projects;
+            try {
+                switch (op) {
+                    case SESSION:
+                        c.initiateSession();
+                        err = c.login(options.user, options.password) ? "" : "login failed";
+                        break;
+                    case UPLOAD:
+                        err = c.uploadArchive("loadgen", options.archive, remotePath, options.course);
+                        break;
+                    case LIST_PROJECT:
+                        err = c.listProject(projects);
+                        break;
+                    case LIST_ALL:
+                        err = c.listAll(projects, options.course);
+                        break;
+                    case JUDGE:
+                        err = c.judge(options.projectOwner, options.projectId, 90);
+                        break;
+                }
+            } catch (const kj::Exception &e) {
+                err = e.getDescription().cStr();
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - begin);
+            stats.latency[op].record(elapsed.count());
+            if (!err.empty()) {
+                stats.errors[op]++;
+            }
+        }
+    } catch (const kj::Exception &e) {
+        std::cerr << "connection " << id << " failed: " << e.getDescription().cStr() << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Drives the server with concurrent clients and reports per-RPC latency.");
+    parser.addHelpOption();
+    parser.addOptions({
+            {"host", "Server host.", "host", "localhost"},
+            {"port", "Server port.", "port", "10100"},
+            {"user", "Account to log in with.", "uid"},
+            {"password", "Password of that account.", "password"},
+            {"connections", "Number of concurrent connections, one thread each.", "n", "16"},
+            {"duration", "Seconds to run.", "s", "30"},
+            {"rate", "Total operations per second; 0 runs closed-loop.", "ops", "0"},
+            {"mix", "Operation weights: session, upload, listProject, listAll, judge.", "mix",
+             "session=1,upload=1,listProject=20,listAll=5,judge=2"},
+            {"upload-size", "Bytes of payload per upload.", "bytes", "1048576"},
+            {"course", "Course passed to upload and listAll.", "name", ""},
+            {"project", "Project id to judge.", "id", "0"},
+            {"project-owner", "Owner of the project to judge; --user if unset.", "uid", ""},
+    });
+    parser.process(a);
+
+    Options options;
+    options.host = parser.value("host").toStdString();
+    options.port = parser.value("port").toInt();
+    options.user = parser.value("user").toStdString();
+    options.password = parser.value("password").toStdString();
+    options.course = parser.value("course").toStdString();
+    options.projectId = parser.value("project").toStdString();
+    options.projectOwner = parser.isSet("project-owner") ? parser.value("project-owner").toStdString() : options.user;
+    options.rate = parser.value("rate").toDouble();
+    options.duration = std::chrono::seconds(parser.value("duration").toUInt());
+    if (!parseMix(parser.value("mix"), options.weights)) {
+        std::cerr << "invalid --mix" << std::endl;
+        return 1;
+    }
+    QTemporaryDir dir;
+    if (options.weights[UPLOAD]) {
+        options.archive = prepareArchive(dir, parser.value("upload-size").toLongLong());
+    }
+
+    unsigned connections = std::max(1u, parser.value("connections").toUInt());
+    std::vector<Stats> stats(connections);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i != connections; ++i) {
+        threads.emplace_back(connection, std::cref(options), i, connections, std::ref(stats[i]));
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%-12s %10s %8s %10s %10s %10s %10s %10s\n", "rpc", "count", "errors", "ops/s", "p50(us)",
+                "p99(us)", "p999(us)", "max(us)");
+    for (int op = 0; op != OP_COUNT; ++op) {
+        Histogram total;
+        uint64_t errors = 0;
+        for (const auto &s: stats) {
+            total.merge(s.latency[op]);
+            errors += s.errors[op];
+        }
+        if (total.count() == 0 && errors == 0) {
+            continue;
+        }
+        std::printf("%-12s %10lu %8lu %10.1f %10lu %10lu %10lu %10lu\n", OP_NAMES[op], total.count(), errors,
+                    total.count() / elapsed.count(), total.quantile(0.5), total.quantile(0.99),
+                    total.quantile(0.999), total.maximum());
+    }
+    return 0;
+}
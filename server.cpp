@@ -1,346 +1,1293 @@
 #include <iostream>
 #include <string>
+#include <algorithm>
 #include <filesystem>
-#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <capnp/message.h>
-#include <capnp/ez-rpc.h>
+#include <capnp/rpc-twoparty.h>
+#include <capnp/schema.h>
+#include <capnp/serialize.h>
+#include <kj/async-io.h>
 #include <kj/debug.h>
 #include <kj/exception.h>
 #include "account.capnp.h"
 #include "system.capnp.h"
 #include <qrsaencryption.h>
-#include "SHA256.h"
+#include "CalcSHA256.h"
+#include "Fingerprint.h"
 #include "third_party/Base64.h"
-#include <sw/redis++/redis++.h>
-#include <QuaZip-Qt5-1.3/quazip/JlCompress.h>
+#include "KeyPool.h"
+#include "Extractor.h"
+#include "Exporter.h"
+#include "ListingCache.h"
+#include "MemoryStorage.h"
+#include "PostgresStorage.h"
+#include "ProjectListing.h"
+#include "AccessLog.h"
+#include "Admission.h"
+#include "Metrics.h"
+#include "Ticket.h"
 #include <QString>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryFile>
 #include <QtSql>
 
-using namespace sw;
+// Receives a streamed upload chunk by chunk into a per-upload temporary file, so memory stays bounded
+// by the flow-control window no matter how large the archive is. Once the client calls end(), the
+// file is mapped and `finish` extracts straight from the mapping.
+class UploadSinkImpl final : public UploadSink::Server {
+public:
+    using Finish = kj::Function<kj::Promise<StoredProject>(kj::ArrayPtr<const kj::byte>)>;
+
+    UploadSinkImpl(std::unique_ptr<QTemporaryFile> file, Finish finish)
+            : file(std::move(file)), finish(kj::mv(finish)) {}
+
+    kj::Promise<void> write(WriteContext cxt) override {
+        KJ_REQUIRE(file != nullptr, "upload already finished");
+        auto bytes = cxt.getParams().getBytes();
+        KJ_REQUIRE(file->write(reinterpret_cast<const char *>(bytes.begin()), bytes.size()) ==
+                   static_cast<qint64>(bytes.size()),
+                   "cannot write upload chunk");
+        return kj::READY_NOW;
+    }
+
+    kj::Promise<void> end(EndContext cxt) override {
+        cxt.getResults().setError("");
+        if (!file) {
+            cxt.getResults().setError("upload already finished");
+            return kj::READY_NOW;
+        }
+        auto done = std::move(file);
+        if (!done->flush()) {
+            cxt.getResults().setError("cannot write upload file");
+            return kj::READY_NOW;
+        }
+        qint64 size = done->size();
+        uchar *mapped = size > 0 ? done->map(0, size) : nullptr;
+        if (size > 0 && !mapped) {
+            cxt.getResults().setError("cannot map upload file");
+            return kj::READY_NOW;
+        }
+        return finish(kj::arrayPtr(reinterpret_cast<const kj::byte *>(mapped), static_cast<size_t>(size)))
+                .then([cxt](StoredProject stored) mutable {
+                    cxt.getResults().setError(stored.error);
+                    cxt.getResults().setId(stored.id);
+                }).attach(std::move(done));
+    }
+
+private:
+    std::unique_ptr<QTemporaryFile> file;
+    Finish finish;
+};
+
+// Latency and failure series for every method of `Interface`, indexed by method ordinal. Servers
+// wrap their dispatchCall() with it, so each method is measured and access-logged without touching
+// its body.
+template<typename Interface>
+class RpcMetrics {
+    std::vector<Metrics::Id> latency;
+    std::vector<Metrics::Id> failures;
+    std::vector<std::string> names; // "Interface.method", as logged
 
-class CalcSHA256 {
-    std::string s;
 public:
-    CalcSHA256(std::string msg) {
-        SHA256 sha;
-        sha.update(msg);
-        auto *digest = sha.digest();
-        s = SHA256::toString(digest);
-        delete[] digest;
+    RpcMetrics() {
+        auto schema = capnp::Schema::from<Interface>();
+        std::string name = schema.getShortDisplayName().cStr();
+        for (auto method: schema.getMethods()) {
+            names.push_back(name + "." + method.getProto().getName().cStr());
+            std::string labels = "interface=\"" + name + "\",method=\"" + method.getProto().getName().cStr() + "\"";
+            latency.push_back(Metrics::timer("gdms_rpc_seconds", "RPC latency from dispatch to completion.",
+                                             labels));
+            failures.push_back(Metrics::counter("gdms_rpc_failures_total", "RPCs that completed with an exception.",
+                                                labels));
+        }
     }
 
-    std::string operator()() const {
-        return s;
+    // `user` is logged with the call. It is only read once the call completes, so a handler that
+    // learns the caller while running can fill it in; null when there is no user.
+    capnp::Capability::Server::DispatchCallResult wrap(uint16_t methodId,
+                                                        capnp::Capability::Server::DispatchCallResult result,
+                                                        std::shared_ptr<const std::string> user = nullptr) {
+        if (methodId < latency.size()) {
+            auto failed = failures[methodId];
+            const std::string *rpc = &names[methodId];
+            auto start = std::chrono::steady_clock::now();
+            result.promise = Metrics::timed(latency[methodId], kj::mv(result.promise))
+                    .then([rpc, user, start] {
+                        AccessLog::record(*rpc, user ? *user : "", std::chrono::steady_clock::now() - start, "ok");
+                    }, [failed, rpc, user, start](kj::Exception &&e) -> kj::Promise<void> {
+                        Metrics::increment(failed);
+                        AccessLog::record(*rpc, user ? *user : "", std::chrono::steady_clock::now() - start,
+                                          e.getDescription().cStr());
+                        return kj::mv(e);
+                    });
+        }
+        return result;
     }
+
+    static RpcMetrics &get() {
+        static RpcMetrics metrics;
+        return metrics;
+    }
+};
+
+// Admission groups, in the order main() configures them.
+enum AdmissionGroup : int {
+    ADMIT_KEYS,   // RSA key generation and decryption
+    ADMIT_UPLOAD, // extraction and disk writes
+    ADMIT_EXPORT, // mapping and streaming whole trees
+};
+
+// Methods gated at dispatch. Streamed uploads are gated when their sink ends instead, since that is
+// where their work happens. Everything else, the listings in particular, is never queued.
+const std::map<std::string, int> ADMITTED_METHODS = {
+        {"initiateSession", ADMIT_KEYS},
+        {"login", ADMIT_KEYS},
+        {"upload", ADMIT_UPLOAD},
+        {"download", ADMIT_EXPORT},
+        {"exportCourse", ADMIT_EXPORT},
 };
 
 class SystemServerImpl final : public System::Server {
-    QSqlDatabase db;
-    redis::Redis redis;
+    Storage &storage;
+    Extractor &extractor;
+    Exporter &exporter;
     QRSAEncryption e;
+    KeyPool &keys;
+    const TicketIssuer &tickets;
+    ListingCache &listings;
+    Admission &admission;
+    const std::vector<int> systemRoutes = Admission::routes<System>(ADMITTED_METHODS);
     std::random_device r;
+    // The access-log user of the System call being dispatched, for handlers that resolve the caller.
+    std::shared_ptr<std::string> caller;
+
+    Session::Client newSession(const std::string &fingerprint, const std::string &uid);
 
 public:
-    explicit SystemServerImpl(const QString &host, const int port, const QString &database, const QString &username,
-                              const QString &password, redis::Redis &&redis) : db(QSqlDatabase::addDatabase("QPSQL")),
-                                                                               redis(std::move(redis)),
-                                                                               e(QRSAEncryption::Rsa::RSA_2048) {
-        db.setHostName(host);
-        db.setDatabaseName(database);
-        db.setUserName(username);
-        db.setPassword(password);
-        db.setPort(port);
-        if (!db.open()) {
-            throw std::runtime_error("cannot open database");
-        }
+    explicit SystemServerImpl(Storage &storage, Extractor &extractor, Exporter &exporter, KeyPool &keys,
+                              const TicketIssuer &tickets, ListingCache &listings, Admission &admission)
+            : storage(storage),
+              extractor(extractor),
+              exporter(exporter),
+              e(QRSAEncryption::Rsa::RSA_2048),
+              keys(keys),
+              tickets(tickets),
+              listings(listings),
+              admission(admission) {}
+
+    const std::vector<int> sessionRoutes = Admission::routes<Session>(ADMITTED_METHODS); // used by SessionImpl
+
+    // Runs `dispatch` under admission control, by the route of `methodId`.
+    template<typename Dispatch>
+    DispatchCallResult admit(const std::vector<int> &routes, uint16_t methodId, Dispatch &&dispatch) {
+        return admission.gate(methodId < routes.size() ? routes[methodId] : -1, kj::fwd<Dispatch>(dispatch));
+    }
+
+    DispatchCallResult dispatchCall(uint64_t interfaceId, uint16_t methodId,
+                                    capnp::CallContext<capnp::AnyPointer, capnp::AnyPointer> context) override {
+        auto user = std::make_shared<std::string>();
+        auto dispatch = [this, interfaceId, methodId, context, user] {
+            caller = user;
+            auto result = System::Server::dispatchCall(interfaceId, methodId, context);
+            caller = nullptr;
+            return result;
+        };
+        return RpcMetrics<System>::get().wrap(methodId, admit(systemRoutes, methodId, kj::mv(dispatch)), user);
+    }
+
+    kj::Promise<void> stats(StatsContext cxt) override {
+        cxt.getResults().setText(Metrics::prometheus());
+        return kj::READY_NOW;
+    }
+
+    std::string generateFingerprint() {
+        return ::generateFingerprint(r);
     }
 
     kj::Promise<void> initiateSession(InitiateSessionContext cxt) override {
-        ::capnp::MallocMessageBuilder msg;
-        std::default_random_engine e1(r());
-        std::uniform_int_distribution<char> dist('A', 'Z');
-        std::string newFingerprint;
-        KJ_LOG(INFO, "Generating new fingerprint...");
-        for (int i = 0; i != 64; ++i) {
-            newFingerprint += dist(e1);
-        }
-        KJ_LOG(INFO, "Generating new RSA pair...");
+        std::string newFingerprint = generateFingerprint();
         QByteArray pub, priv;
-        e.generatePairKey(pub, priv);
-        redis.set(newFingerprint + "pubkey", pub.toStdString(), std::chrono::minutes(20));
-        redis.set(newFingerprint + "privkey", priv.toStdString(), std::chrono::minutes(20));
-        auto pack = msg.initRoot<InitPack>();
+        if (auto pair = keys.tryPop()) {
+            std::tie(pub, priv) = std::move(*pair);
+        } else {
+            auto stats = keys.stats();
+            KJ_LOG(WARNING, "key pool empty, generating RSA pair inline", stats.hits, stats.misses, stats.refillRate);
+            static const auto timer = Metrics::timer("gdms_rsa_keygen_seconds", "Time to generate an RSA key pair.",
+                                                     "source=\"inline\"");
+            Metrics::Stopwatch generating(timer);
+            e.generatePairKey(pub, priv);
+        }
+        auto pack = cxt.getResults().initPack();
         pack.setFingerprint(newFingerprint);
-        uint8_t bytes[pub.size()];
-        for (int i = 0; i != pub.size(); ++i) bytes[i] = pub[i];
-        auto ptr = kj::arrayPtr(bytes, pub.size());
-        pack.setPubkey(ptr);
-        cxt.getResults().setPack(pack);
-        return kj::READY_NOW;
+        pack.setPubkey(kj::arrayPtr(reinterpret_cast<const kj::byte *>(pub.constData()), pub.size()));
+        return storage.createSession(newFingerprint, pub, priv);
     }
 
     kj::Promise<void> login(LoginContext cxt) override {
         cxt.getResults().setError("");
-        QSqlQuery statement;
-        statement.prepare("SELECT password from accounts where uid = ?;");
-        statement.addBindValue(cxt.getParams().getUid().cStr());
+        std::string uid = cxt.getParams().getUid();
         std::string fingerprint = cxt.getParams().getFingerprint();
-        statement.exec();
-        if (statement.next()) {
-            auto maybePubkey = redis.get(fingerprint + "pubkey");
-            if (maybePubkey) {
-                QByteArray pas, privkey;
-                auto pp = *redis.get(fingerprint + "privkey");
-                for (const auto &x: cxt.getParams().getPassword()) pas.push_back(x);
-                for (const auto &x: pp) privkey.push_back(x);
-                std::string passwordSHA = CalcSHA256(e.decode(pas, privkey).toStdString())();
-                auto truePassword = statement.value(0).toString().toStdString();
-                if (passwordSHA == truePassword) {
-                    redis.set(fingerprint + "loginAs", cxt.getParams().getUid().cStr(), std::chrono::minutes(20));
-                    redis.expire(fingerprint + "pubkey", std::chrono::minutes(20));
-                    redis.expire(fingerprint + "privkey", std::chrono::minutes(20));
-                    return kj::READY_NOW;
-                } else {
-                    cxt.getResults().setError("incorrect password");
-                }
-            } else {
+        // The key lookup is in flight while the password query runs.
+        auto privateKey = storage.privateKey(fingerprint);
+        return storage.credentials(uid).then([privateKey = kj::mv(privateKey)](
+                std::optional<Credentials> account) mutable {
+            return privateKey.then([account = std::move(account)](std::optional<QByteArray> key) mutable {
+                return std::make_pair(std::move(account), std::move(key));
+            });
+        }).then([this, cxt, uid, fingerprint, logged = caller](
+                std::pair<std::optional<Credentials>, std::optional<QByteArray>> found) mutable -> kj::Promise<void> {
+            auto &[account, privkey] = found;
+            if (!account) {
+                cxt.getResults().setError("non-existent account");
+                return kj::READY_NOW;
+            }
+            if (!privkey) {
                 cxt.getResults().setError("session not initiated or expired");
+                return kj::READY_NOW;
             }
-        } else {
-            cxt.getResults().setError("non-existent account");
+            QByteArray pas;
+            for (const auto &x: cxt.getParams().getPassword()) pas.push_back(x);
+            static const auto timer = Metrics::timer("gdms_rsa_decode_seconds", "Time to decrypt a login password.");
+            QByteArray decoded;
+            {
+                Metrics::Stopwatch decoding(timer);
+                decoded = e.decode(pas, *privkey);
+            }
+            std::string passwordSHA = CalcSHA256(decoded.toStdString())();
+            if (passwordSHA != account->passwordHash) {
+                cxt.getResults().setError("incorrect password");
+                return kj::READY_NOW;
+            }
+            if (logged) {
+                *logged = uid;
+            }
+            auto stored = storage.setLogin(fingerprint, uid);
+            cxt.getResults().setSession(newSession(fingerprint, uid));
+            std::string ticket = tickets.issue(uid, account->ticketEpoch);
+            cxt.getResults().setTicket(kj::arrayPtr(reinterpret_cast<const kj::byte *>(ticket.data()), ticket.size()));
+            return stored;
+        });
+    }
+
+    // Logs the ticket holder in again under a fresh fingerprint, unless the account's tickets have been
+    // revoked since. The session hash only gets loginAs, since no password will be sent under it. The
+    // reply carries a renewed ticket that expires when the presented one does.
+    kj::Promise<void> resume(ResumeContext cxt) override {
+        cxt.getResults().setError("");
+        auto raw = cxt.getParams().getTicket();
+        auto presented = tickets.verify(std::string(reinterpret_cast<const char *>(raw.begin()), raw.size()));
+        if (!presented) {
+            cxt.getResults().setError("invalid or expired ticket");
+            return kj::READY_NOW;
         }
-        return kj::READY_NOW;
+        return storage.ticketEpoch(presented->uid).then([this, cxt, ticket = std::move(*presented), logged = caller](
+                std::optional<int64_t> epoch) mutable -> kj::Promise<void> {
+            if (epoch != ticket.epoch) {
+                cxt.getResults().setError("invalid or expired ticket");
+                return kj::READY_NOW;
+            }
+            if (logged) {
+                *logged = ticket.uid;
+            }
+            std::string fingerprint = generateFingerprint();
+            auto stored = storage.setLogin(fingerprint, ticket.uid);
+            auto results = cxt.getResults();
+            results.setFingerprint(fingerprint);
+            results.setSession(newSession(fingerprint, ticket.uid));
+            std::string renewed = tickets.issue(ticket);
+            results.setTicket(kj::arrayPtr(reinterpret_cast<const kj::byte *>(renewed.data()), renewed.size()));
+            return stored;
+        });
+    }
+
+    // Logging out also revokes every resumption ticket of the user, so a stolen ticket stops working
+    // with the next logout.
+    kj::Promise<void> endSession(const std::string &fingerprint, const std::string &uid) {
+        auto revoked = storage.revokeTickets(uid);
+        return storage.endSession(fingerprint).then([revoked = kj::mv(revoked)]() mutable {
+            return kj::mv(revoked);
+        });
     }
 
     kj::Promise<void> logout(LogoutContext cxt) override {
         std::string fingerprint = cxt.getParams().getFingerprint();
-        redis.del(fingerprint + "pubkey");
-        redis.del(fingerprint + "privkey");
-        redis.del(fingerprint + "loginAs");
-        KJ_LOG(INFO, ("logging out: " + fingerprint));
-        return kj::READY_NOW;
+        return storage.loginOf(fingerprint).then([this, fingerprint](std::optional<std::string> uid) {
+            return uid ? endSession(fingerprint, *uid) : storage.endSession(fingerprint);
+        });
     }
 
     template<typename Context>
-    void withLogin(Context &cxt, const std::function<void(const std::string &)> &cont,
-                   const std::function<void(void)> &handler) {
+    kj::Promise<void> withLogin(Context cxt, kj::Function<kj::Promise<void>(const std::string &)> cont,
+                                kj::Function<void(void)> handler) {
         std::string fingerprint = cxt.getParams().getFingerprint();
-        auto user = redis.get(fingerprint + "loginAs");
-        if (user) {
-            cont(*user);
-        } else {
-            handler();
+        return storage.loginOf(fingerprint)
+                .then([cont = kj::mv(cont), handler = kj::mv(handler), logged = caller](
+                        std::optional<std::string> user) mutable -> kj::Promise<void> {
+                    if (user) {
+                        if (logged) {
+                            *logged = *user;
+                        }
+                        return cont(*user);
+                    }
+                    handler();
+                    return kj::READY_NOW;
+                });
+    }
+
+    // Extracts an uploaded archive into the user's tree and records the project. `archive` must stay
+    // valid until the returned promise resolves.
+    kj::Promise<StoredProject> storeProject(const std::string &trueUser, const std::string &name,
+                                          const std::string &path, const std::string &course,
+                                          kj::ArrayPtr<const kj::byte> archive) {
+        std::string local = trueUser + "/" + path;
+        std::filesystem::create_directories(local);
+        return extractor.extract(archive, QString::fromStdString(local))
+                .then([this, trueUser, name, path, course](std::string error) -> kj::Promise<StoredProject> {
+                    if (!error.empty()) {
+                        return StoredProject{error};
+                    }
+                    return recordProject(trueUser, name, path, course);
+                });
+    }
+
+    // Completes a delta upload: extracts the files the client sent, links the ones the store already
+    // had, then records the project.
+    kj::Promise<StoredProject> storeDelta(const std::string &trueUser, const std::string &name,
+                                          const std::string &path, const std::string &course,
+                                          std::vector<std::pair<std::string, std::string>> present,
+                                          kj::ArrayPtr<const kj::byte> archive) {
+        std::string local = trueUser + "/" + path;
+        std::filesystem::create_directories(local);
+        QString dest = QString::fromStdString(local);
+        kj::Promise<std::string> extracted = archive.size() == 0 ? kj::Promise<std::string>(std::string())
+                                                                 : extractor.extract(archive, dest);
+        return extracted.then([this, dest, present = std::move(present)](std::string error) mutable
+                                      -> kj::Promise<std::string> {
+            if (!error.empty()) {
+                return error;
+            }
+            return extractor.link(std::move(present), dest);
+        }).then([this, trueUser, name, path, course](std::string error) -> kj::Promise<StoredProject> {
+            if (!error.empty()) {
+                return StoredProject{error};
+            }
+            return recordProject(trueUser, name, path, course);
+        });
+    }
+
+    kj::Promise<StoredProject> recordProject(const std::string &trueUser, const std::string &name,
+                                             const std::string &path, const std::string &course) {
+        return storage.recordProject(trueUser, name, path, course).then([this, trueUser, course](StoredProject stored) {
+            if (stored.error.empty()) {
+                listings.invalidate(listingTags(trueUser, course));
+            }
+            return stored;
+        });
+    }
+
+    // Bodies of the authenticated methods. They are shared by the fingerprint-based methods on System
+    // and by SessionImpl, whose contexts have the same parameters minus the fingerprint.
+
+    // Project paths are relative and have no ".." components, so "<owner>/<path>" stays inside the
+    // owner's tree.
+    static bool isProjectPath(const std::string &path) {
+        if (!path.empty() && path.front() == '/') {
+            return false;
         }
+        for (const auto &part: QString::fromStdString(path).split('/')) {
+            if (part == "..") {
+                return false;
+            }
+        }
+        return true;
     }
 
-    kj::Promise<void> upload(UploadContext cxt) override {
+    // The canonical directory of a stored project, or an empty string unless it lies inside the owner's
+    // tree. Paths recorded before uploads were checked are not trusted.
+    static QString projectRoot(const std::string &owner, const std::string &path) {
+        QString home = QFileInfo(QString::fromStdString(owner)).canonicalFilePath();
+        QString root = QFileInfo(QString::fromStdString(owner + "/" + path)).canonicalFilePath();
+        if (home.isEmpty() || root.isEmpty() || (root != home && !root.startsWith(home + '/'))) {
+            return {};
+        }
+        return root;
+    }
+
+    // Resolves to an error message unless `uid` may upload into `course` at `path`; projects outside
+    // a course need no enrolment.
+    kj::Promise<std::string> checkUpload(const std::string &course, const std::string &path, const std::string &uid) {
+        if (!isProjectPath(path)) {
+            return std::string("invalid project path");
+        }
+        if (course.empty()) {
+            return std::string();
+        }
+        return storage.isEnrolled(course, uid).then([](bool enrolled) {
+            return enrolled ? std::string() : std::string("not enrolled in course");
+        });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleUpload(Context cxt, const std::string &trueUser) {
+        cxt.getResults().setError("");
+        return checkUpload(cxt.getParams().getCourse(), cxt.getParams().getPath(), trueUser)
+                .then([this, cxt, trueUser](std::string error) mutable -> kj::Promise<StoredProject> {
+                    if (!error.empty()) {
+                        return StoredProject{error};
+                    }
+                    // The archive is extracted straight out of the request message, which stays alive until we return.
+                    return storeProject(trueUser, cxt.getParams().getName(), cxt.getParams().getPath(),
+                                        cxt.getParams().getCourse(), cxt.getParams().getData());
+                }).then([cxt](StoredProject stored) mutable {
+                    cxt.getResults().setError(stored.error);
+                    cxt.getResults().setId(stored.id);
+                });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleUploadStream(Context cxt, const std::string &trueUser) {
+        cxt.getResults().setError("");
+        std::string name = cxt.getParams().getName();
+        std::string path = cxt.getParams().getPath();
+        std::string course = cxt.getParams().getCourse();
+        return checkUpload(course, path, trueUser).then([this, cxt, trueUser, name, path, course](
+                std::string error) mutable {
+            if (!error.empty()) {
+                cxt.getResults().setError(error);
+                return;
+            }
+            auto file = std::make_unique<QTemporaryFile>(QDir::tempPath() + "/upload-XXXXXX.zip");
+            if (!file->open()) {
+                cxt.getResults().setError("cannot create upload file");
+                return;
+            }
+            cxt.getResults().setSink(kj::heap<UploadSinkImpl>(
+                    std::move(file),
+                    [this, self = thisCap(), trueUser, name, path, course](kj::ArrayPtr<const kj::byte> archive) {
+                        return admission.acquire(ADMIT_UPLOAD).then(
+                                [this, trueUser, name, path, course, archive](kj::Own<Admission::Permit> permit) {
+                                    return storeProject(trueUser, name, path, course, archive).attach(kj::mv(permit));
+                                });
+                    }));
+        });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleUploadDelta(Context cxt, const std::string &trueUser) {
+        cxt.getResults().setError("");
+        std::string name = cxt.getParams().getName();
+        std::string path = cxt.getParams().getPath();
+        std::string course = cxt.getParams().getCourse();
+        auto manifest = cxt.getParams().getManifest();
+        std::vector<std::pair<std::string, std::string>> files;
+        std::vector<std::string> hashes;
+        files.reserve(manifest.size());
+        hashes.reserve(manifest.size());
+        for (auto entry: manifest) {
+            std::string hash = entry.getSha256();
+            if (!BlobStore::isHash(hash)) {
+                cxt.getResults().setError("invalid hash for " + std::string(entry.getPath().cStr()));
+                return kj::READY_NOW;
+            }
+            files.emplace_back(entry.getPath().cStr(), hash);
+            hashes.push_back(hash);
+        }
+        auto found = extractor.contains(std::move(hashes), QString::fromStdString(trueUser));
+        return checkUpload(course, path, trueUser).then([found = kj::mv(found)](std::string error) mutable {
+            return found.then([error = std::move(error)](std::vector<bool> found) mutable {
+                return std::make_pair(std::move(error), std::move(found));
+            });
+        }).then([this, cxt, trueUser, name, path, course, files = std::move(files)](
+                std::pair<std::string, std::vector<bool>> checked) mutable {
+            auto &[error, found] = checked;
+            if (!error.empty()) {
+                cxt.getResults().setError(error);
+                return;
+            }
+            std::vector<std::pair<std::string, std::string>> present;
+            std::vector<uint32_t> missing;
+            for (size_t i = 0; i != files.size(); ++i) {
+                if (found[i]) {
+                    present.push_back(std::move(files[i]));
+                } else {
+                    missing.push_back(static_cast<uint32_t>(i));
+                }
+            }
+            auto list = cxt.getResults().initMissing(missing.size());
+            for (size_t i = 0; i != missing.size(); ++i) {
+                list.set(i, missing[i]);
+            }
+            auto file = std::make_unique<QTemporaryFile>(QDir::tempPath() + "/upload-XXXXXX.zip");
+            if (!file->open()) {
+                cxt.getResults().setError("cannot create upload file");
+                return;
+            }
+            cxt.getResults().setSink(kj::heap<UploadSinkImpl>(
+                    std::move(file),
+                    [this, self = thisCap(), trueUser, name, path, course, present = std::move(present)](
+                            kj::ArrayPtr<const kj::byte> archive) mutable {
+                        return admission.acquire(ADMIT_UPLOAD).then(
+                                [this, trueUser, name, path, course, present = std::move(present), archive](
+                                        kj::Own<Admission::Permit> permit) mutable {
+                                    return storeDelta(trueUser, name, path, course, std::move(present), archive)
+                                            .attach(kj::mv(permit));
+                                });
+                    }));
+        });
+    }
+
+    // Streams one project into the caller's sink. Teachers may fetch anyone's project by naming its
+    // owner; everybody else only their own.
+    template<typename Context>
+    kj::Promise<void> handleDownload(Context cxt, const std::string &user) {
+        cxt.getResults().setError("");
+        auto params = cxt.getParams();
+        std::string pid = params.getPid();
+        std::string owner = params.hasOwner() && params.getOwner().size() ? params.getOwner().cStr() : user;
+        return storage.projectPath(user, owner, pid).then([this, cxt, owner](
+                std::pair<std::string, std::string> found) mutable -> kj::Promise<void> {
+            auto &[error, path] = found;
+            if (!error.empty()) {
+                cxt.getResults().setError(error);
+                return kj::READY_NOW;
+            }
+            QString root = projectRoot(owner, path);
+            if (root.isEmpty()) {
+                cxt.getResults().setError("invalid project path");
+                return kj::READY_NOW;
+            }
+            std::vector<Exporter::Source> sources{{root, ""}};
+            return exporter.send(std::move(sources), cxt.getParams().getZip(), cxt.getParams().getSink())
+                    .then([cxt](std::string error) mutable {
+                        cxt.getResults().setError(error);
+                    });
+        });
+    }
+
+    // Streams every project of a course, each under "<owner>/<pid>-<name>/". Teachers only.
+    template<typename Context>
+    kj::Promise<void> handleExportCourse(Context cxt, const std::string &user) {
+        cxt.getResults().setError("");
+        std::string course = cxt.getParams().getCourse();
+        using Found = std::pair<std::string, std::vector<CourseProject>>;
+        return storage.courseProjects(user, course).then([this, cxt](Found found) mutable -> kj::Promise<void> {
+            if (!found.first.empty()) {
+                cxt.getResults().setError(found.first);
+                return kj::READY_NOW;
+            }
+            std::vector<Exporter::Source> sources;
+            for (auto &project: found.second) {
+                QString root = projectRoot(project.owner, project.path);
+                if (root.isEmpty()) {
+                    cxt.getResults().setError("invalid project path");
+                    return kj::READY_NOW;
+                }
+                std::replace(project.name.begin(), project.name.end(), '/', '_');
+                sources.push_back({root,
+                                   project.owner + "/" + project.pid + "-" + project.name + "/"});
+            }
+            return exporter.send(std::move(sources), cxt.getParams().getZip(), cxt.getParams().getSink())
+                    .then([cxt](std::string error) mutable {
+                        cxt.getResults().setError(error);
+                    });
+        });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleRemove(Context cxt, const std::string &user) {
+        std::string pid = cxt.getParams().getPid();
+        return storage.removeProject(user, pid).then([this, user](std::optional<std::string> course) {
+            if (course) {
+                listings.invalidate(listingTags(user, *course));
+            }
+        });
+    }
+
+    // Cache tags of every listing that shows a project of `owner` in `course`. Whatever changes such
+    // a project invalidates these.
+    static std::vector<std::string> listingTags(const std::string &owner, const std::string &course) {
+        std::vector<std::string> tags{"user:" + owner, "all"};
+        if (!course.empty()) {
+            tags.push_back("course:" + course);
+        }
+        return tags;
+    }
+
+    // The reply is sized to hold the whole listing in its first segment, so copying the listing in is
+    // the only copy made per request.
+    template<typename Context>
+    static auto setProjects(Context &cxt, const ListingCache::Listing &listing, size_t extraWords = 0) {
+        ::capnp::SegmentArrayMessageReader reader(listing.message.segments());
+        auto results = cxt.initResults(::capnp::MessageSize{listing.message.sizeInWords() + extraWords + 8, 0});
+        results.setResult(reader.getRoot<Either<BoxedText, ::capnp::List<Project>>>());
+        return results;
+    }
+
+    template<typename Context>
+    static void setPage(Context &cxt, const ListingCache::Listing &page) {
+        auto results = setProjects(cxt, page, page.nextCursor.size() / sizeof(::capnp::word) + 1);
+        if (!page.nextCursor.empty()) {
+            results.setNextCursor(
+                    kj::arrayPtr(reinterpret_cast<const kj::byte *>(page.nextCursor.data()), page.nextCursor.size()));
+        }
+    }
+
+    template<typename Context>
+    static void setProjectsError(Context &cxt, const std::string &error) {
+        cxt.getResults().initResult().initLeft().setValue(error);
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleListProject(Context cxt, const std::string &user) {
+        std::string key = "user:" + user;
+        if (auto cached = listings.get(key)) {
+            setProjects(cxt, *cached);
+            return kj::READY_NOW;
+        }
+        auto readAt = listings.version();
+        return storage.listProjects(user, &encodeProjects).then([this, cxt, key, readAt](
+                std::shared_ptr<const ListingCache::Listing> listing) mutable {
+            listings.put(key, {key}, readAt, listing);
+            setProjects(cxt, *listing);
+        });
+    }
+
+    static constexpr uint32_t DEFAULT_PAGE_SIZE = 100;
+    static constexpr uint32_t MAX_PAGE_SIZE = 1000;
+
+    template<typename Context>
+    kj::Promise<void> handleListAll(Context cxt, const std::string &user) {
+        auto params = cxt.getParams();
+        std::string course = params.getCourseName();
+        uint32_t pageSize = params.getPageSize() == 0 ? DEFAULT_PAGE_SIZE
+                                                      : std::min(params.getPageSize(), MAX_PAGE_SIZE);
+        std::optional<ListPosition> after;
+        if (params.hasCursor()) {
+            after.emplace();
+            if (!decodeCursor(params.getCursor(), after->pid, after->user)) {
+                setProjectsError(cxt, "invalid cursor");
+                return kj::READY_NOW;
+            }
+        }
+        std::string tag = course.empty() ? "all" : "course:" + course;
+        std::string key = tag + '\0' + std::to_string(pageSize) + '\0';
+        if (after) {
+            key.append(reinterpret_cast<const char *>(params.getCursor().begin()), params.getCursor().size());
+        }
+        if (auto cached = listings.get(key)) {
+            setPage(cxt, *cached);
+            return kj::READY_NOW;
+        }
+        auto readAt = listings.version();
+        return storage.listAll(course, pageSize, after, &encodeProjects).then([this, cxt, key, tag, readAt](
+                std::shared_ptr<const ListingCache::Listing> page) mutable {
+            listings.put(key, {tag}, readAt, page);
+            setPage(cxt, *page);
+        });
+    }
+
+    // Roster changes are for the course's teacher; other callers get an error and change nothing.
+    template<typename Context>
+    kj::Promise<void> handleAddStudent(Context cxt, const std::string &user) {
+        cxt.getResults().setError("");
+        auto uid = cxt.getParams().getUid();
+        return storage.enroll(user, cxt.getParams().getCourseName(), {{uid.begin(), uid.size()}})
+                .then([cxt](std::pair<std::string, uint32_t> changed) mutable {
+                    cxt.getResults().setError(changed.first);
+                });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleRemoveStudent(Context cxt, const std::string &user) {
+        cxt.getResults().setError("");
+        auto uid = cxt.getParams().getUid();
+        return storage.unenroll(user, cxt.getParams().getCourseName(), {{uid.begin(), uid.size()}})
+                .then([cxt](std::pair<std::string, uint32_t> changed) mutable {
+                    cxt.getResults().setError(changed.first);
+                });
+    }
+
+    // `count` reports how many uids actually joined or left the roster.
+    template<typename Context>
+    kj::Promise<void> changeRoster(Context cxt, const std::string &user, bool join) {
+        cxt.getResults().setError("");
+        auto uids = cxt.getParams().getUids();
+        std::vector<std::string_view> members;
+        members.reserve(uids.size());
+        for (auto uid: uids) {
+            members.emplace_back(uid.begin(), uid.size());
+        }
+        std::string course = cxt.getParams().getCourseName();
+        auto changed = join ? storage.enroll(user, course, std::move(members))
+                            : storage.unenroll(user, course, std::move(members));
+        return changed.then([cxt](std::pair<std::string, uint32_t> changed) mutable {
+            cxt.getResults().setError(changed.first);
+            cxt.getResults().setCount(changed.second);
+        });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleEnrollStudents(Context cxt, const std::string &user) {
+        return changeRoster(cxt, user, true);
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleUnenrollStudents(Context cxt, const std::string &user) {
+        return changeRoster(cxt, user, false);
+    }
+
+    // Teachers only. Project ids are only unique per owner, so the owner has to be named.
+    template<typename Context>
+    kj::Promise<void> handleJudge(Context cxt, const std::string &user) {
+        cxt.getResults().setError("");
+        auto params = cxt.getParams();
+        if (!params.hasOwner() || params.getOwner().size() == 0) {
+            cxt.getResults().setError("missing project owner");
+            return kj::READY_NOW;
+        }
+        return storage.judge(user, params.getOwner().cStr(), params.getId().cStr(), params.getScore())
+                .then([this, cxt](std::pair<std::string, std::optional<GradedProject>> graded) mutable {
+                    cxt.getResults().setError(graded.first);
+                    if (graded.second) {
+                        listings.invalidate(listingTags(graded.second->owner, graded.second->course));
+                    }
+                });
+    }
+
+    // Grades are applied in a single storage call, so a whole cohort costs one round trip. Project ids
+    // are only unique per owner, so grades are keyed on (owner, id); if one repeats, its last score wins.
+    // Teachers only.
+    template<typename Context>
+    kj::Promise<void> handleJudgeMany(Context cxt, const std::string &user) {
+        using Key = std::pair<std::string, int>;
         cxt.getResults().setError("");
-        withLogin(cxt, [&](auto trueUser) {
-            std::string path = cxt.getParams().getPath();
-            std::string local = trueUser + "/" + path;
-            std::filesystem::create_directories(local);
-            std::string tmpname = "tmp.zip";
-            std::ofstream outFile(tmpname);
-            auto buf = cxt.getParams().getData();
-            for (const auto &x: buf) {
-                outFile << x;
+        auto grades = cxt.getParams().getGrades();
+        auto status = cxt.getResults().initStatus(grades.size());
+        std::map<Key, float> latest;
+        std::vector<std::optional<Key>> keys(grades.size());
+        for (unsigned i = 0; i != grades.size(); ++i) {
+            bool ok;
+            int id = QString(grades[i].getId().cStr()).toInt(&ok);
+            if (!ok) {
+                status.set(i, "invalid project id");
+                continue;
+            }
+            if (!grades[i].hasOwner() || grades[i].getOwner().size() == 0) {
+                status.set(i, "missing project owner");
+                continue;
+            }
+            keys[i] = Key(grades[i].getOwner().cStr(), id);
+            latest[*keys[i]] = grades[i].getScore();
+        }
+        if (latest.empty()) {
+            return kj::READY_NOW;
+        }
+        using Graded = std::pair<std::string, std::vector<GradedProject>>;
+        return storage.judgeMany(user, std::move(latest)).then([this, cxt, keys = std::move(keys)](
+                Graded graded) mutable {
+            if (!graded.first.empty()) {
+                cxt.getResults().setError(graded.first);
+                return;
+            }
+            std::set<Key> updated;
+            std::set<std::string> touched;
+            for (const auto &project: graded.second) {
+                updated.emplace(project.owner, project.pid);
+                for (auto &tag: listingTags(project.owner, project.course)) {
+                    touched.insert(std::move(tag));
+                }
+            }
+            if (!touched.empty()) {
+                listings.invalidate({touched.begin(), touched.end()});
+            }
+            auto status = cxt.getResults().getStatus();
+            for (unsigned i = 0; i != keys.size(); ++i) {
+                if (keys[i] && !updated.count(*keys[i])) {
+                    status.set(i, "no such project");
+                }
             }
-            outFile.close();
-            JlCompress::extractDir(QString::fromStdString(tmpname), QString::fromStdString(local));
-
-            QSqlQuery statement;
-            statement.prepare("SELECT counter FROM accounts where uid = ?;");
-            statement.addBindValue(trueUser.c_str());
-            statement.exec();
-            statement.next();
-            const int counter = statement.value(0).toInt();
-            statement.prepare("UPDATE accounts SET counter = counter + 1 where uid = ?;");
-            statement.addBindValue(trueUser.c_str());
-            statement.exec();
-            statement.prepare("INSERT INTO projects VALUES(?, ?, ?);");
-            statement.addBindValue(counter);
-            statement.addBindValue(cxt.getParams().getName().cStr());
-            statement.addBindValue(trueUser.c_str());
-            statement.exec();
-        }, [&cxt]() {
+        });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleNewCourse(Context cxt, const std::string &user) {
+        std::default_random_engine e1(r());
+        std::uniform_int_distribution<char> dist('0', '9');
+        std::string courseId(64, '0');
+        for (auto &x: courseId) {
+            x = dist(e1);
+        }
+        std::string courseName = cxt.getParams().getCourseName();
+        return storage.newCourse(user, courseId, courseName).then([cxt](bool teacher) mutable {
+            if (!teacher) {
+                cxt.getResults().setError(NOT_TEACHER);
+            }
+        });
+    }
+
+    template<typename Context>
+    kj::Promise<void> handleDeleteCourse(Context cxt, const std::string &user) {
+        std::string courseId = cxt.getParams().getCourseId();
+        return storage.deleteCourse(user, courseId).then([cxt](std::string error) mutable {
+            cxt.getResults().setError(error);
+        });
+    }
+
+    // Fingerprint-based entry points, kept for clients that do not hold a Session.
+
+    kj::Promise<void> upload(UploadContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleUpload(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> uploadStream(UploadStreamContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleUploadStream(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> uploadDelta(UploadDeltaContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleUploadDelta(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> download(DownloadContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleDownload(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> exportCourse(ExportCourseContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleExportCourse(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> remove(RemoveContext cxt) override {
-        withLogin(cxt, [&](auto user) {
-            QSqlQuery statement;
-            statement.prepare("DELETE FROM projects WHERE \"user\" = ? AND pid = ?;");
-            statement.addBindValue(QString::fromStdString(user));
-            statement.addBindValue(cxt.getParams().getPid().cStr());
-            statement.exec();
-        }, [&cxt]() {
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleRemove(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> listProject(ListProjectContext cxt) override {
-        ::capnp::MallocMessageBuilder msg;
-        withLogin(cxt, [&](auto user) {
-            QSqlQuery statement;
-            statement.prepare("SELECT name, pid FROM projects WHERE \"user\" = ?;");
-            KJ_LOG(INFO, user);
-            statement.addBindValue(user.c_str());
-            statement.exec();
-            auto result = msg.initRoot<Either<BoxedText, ::capnp::List<Project>>>();
-            int ss = 0;
-            if (db.driver()->hasFeature(QSqlDriver::QuerySize)) {
-                ss = statement.size();
-            } else {
-                statement.last();
-                ss = statement.at() + 1;
-                statement.first();
-            }
-            auto ls = result.initRight(ss);
-            int i = 0;
-            while (statement.next()) {
-                ls[i].setName(statement.value(0).toString().toStdString());
-                ls[i].setId(statement.value(1).toInt());
-                ++i;
-            }
-            cxt.getResults().setResult(result);
-        }, [&]() {
-            auto either = msg.initRoot<Either<BoxedText, ::capnp::List<Project>>>();
-            auto err = msg.initRoot<BoxedText>();
-            err.setValue("please login first");
-            either.setLeft(err);
-            cxt.getResults().setResult(either);
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleListProject(cxt, user);
+        }, [cxt]() mutable {
+            setProjectsError(cxt, "please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> listAll(ListAllContext cxt) override {
-        ::capnp::MallocMessageBuilder msg;
-        withLogin(cxt, [&](auto user) {
-            QSqlQuery statement;
-            statement.prepare("SELECT name, pid FROM projects;");
-            KJ_LOG(INFO, user);
-            statement.exec();
-            auto result = msg.initRoot<Either<BoxedText, ::capnp::List<Project>>>();
-            int ss = 0;
-            if (db.driver()->hasFeature(QSqlDriver::QuerySize)) {
-                ss = statement.size();
-            } else {
-                statement.last();
-                ss = statement.at() + 1;
-                statement.first();
-            }
-            auto ls = result.initRight(ss);
-            int i = 0;
-            while (statement.next()) {
-                ls[i].setName(statement.value(0).toString().toStdString());
-                ls[i].setId(statement.value(1).toInt());
-                ++i;
-            }
-            cxt.getResults().setResult(result);
-        }, [&]() {
-            auto either = msg.initRoot<Either<BoxedText, ::capnp::List<Project>>>();
-            auto err = msg.initRoot<BoxedText>();
-            err.setValue("please login first");
-            either.setLeft(err);
-            cxt.getResults().setResult(either);
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleListAll(cxt, user);
+        }, [cxt]() mutable {
+            setProjectsError(cxt, "please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> addStudent(AddStudentContext cxt) override {
-        withLogin(cxt, [&](auto user) {
-            redis.append(cxt.getParams().getCourseName().cStr(), cxt.getParams().getUid().cStr());
-        }, [&cxt]() {
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleAddStudent(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> removeStudent(RemoveStudentContext cxt) override {
-        withLogin(cxt, [&](auto user) {
-            redis.lrem(cxt.getParams().getCourseName().cStr(), 1, cxt.getParams().getUid().cStr());
-        }, [&cxt]() {
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleRemoveStudent(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> enrollStudents(EnrollStudentsContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleEnrollStudents(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> unenrollStudents(UnenrollStudentsContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleUnenrollStudents(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> judge(JudgeContext cxt) override {
-        withLogin(cxt, [&](auto user) {
-            QSqlQuery statement;
-            statement.prepare("UPDATE projects SET score = ? WHERE pid = ?;");
-            statement.addBindValue(cxt.getParams().getScore());
-            statement.addBindValue(cxt.getParams().getId().cStr());
-            statement.exec();
-        }, [&cxt]() {
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleJudge(cxt, user);
+        }, [cxt]() mutable {
+            cxt.getResults().setError("please login first");
+        });
+    }
+
+    kj::Promise<void> judgeMany(JudgeManyContext cxt) override {
+        cxt.getResults().setError("");
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleJudgeMany(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
 
     kj::Promise<void> newCourse(NewCourseContext cxt) override {
-        std::default_random_engine e1(r());
-        std::uniform_int_distribution<char> dist('0', '9');
-        withLogin(cxt, [&](auto user) {
-            QSqlQuery statement;
-            statement.prepare("SELECT * FROM teacher WHERE uid = ?");
-            statement.addBindValue(QString::fromStdString(user));
-            statement.exec();
-            if (statement.next()) {
-                char courseId[64];
-                for (auto &x : courseId) {
-                    x = dist(e1);
-                }
-                statement.prepare("INSERT INTO courses VALUES(?,?,?)");
-                statement.addBindValue(courseId);
-                statement.addBindValue(cxt.getParams().getCourseName().cStr());
-                statement.addBindValue(QString::fromStdString(user));
-                statement.exec();
-                redis.append(user+"Courses", courseId);
-            } else {
-                cxt.getResults().setError("permisson denied: you're not a teacher");
-            }
-        }, [&cxt]() {
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleNewCourse(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
+
     kj::Promise<void> deleteCourse(DeleteCourseContext cxt) override {
-        withLogin(cxt, [&](auto user) {
-            QSqlQuery statement;
-            statement.prepare("SELECT * FROM teacher WHERE uid = ?");
-            statement.addBindValue(QString::fromStdString(user));
-            statement.exec();
-            if (statement.next()) {
-                redis.lrem(user+"Courses", 1, cxt.getParams().getCourseId().cStr());
-                statement.prepare("DELETE courses WHERE \"id\" = ?");
-                statement.addBindValue(QString::fromStdString(cxt.getParams().getCourseId()));
-                statement.exec();
-            } else {
-                cxt.getResults().setError("permisson denied: you're not a teacher");
-            }
-        }, [&cxt]() {
+        return withLogin(cxt, [this, cxt](auto user) mutable {
+            return handleDeleteCourse(cxt, user);
+        }, [cxt]() mutable {
             cxt.getResults().setError("please login first");
         });
-        return kj::READY_NOW;
     }
 };
 
+// Capability handed out by a successful login. The user's identity lives here for as long as the
+// client holds the capability, so none of its methods has to look the session up in Redis.
+class SessionImpl final : public Session::Server {
+    System::Client self; // keeps `server` alive while the session is referenced
+    SystemServerImpl &server;
+    std::string fingerprint;
+    std::string uid;
+    std::shared_ptr<const std::string> loggedUid; // uid, as the access log takes it
+    bool active = true;
+
+    void check() {
+        KJ_REQUIRE(active, "session has been logged out");
+    }
+
+public:
+    SessionImpl(System::Client self, SystemServerImpl &server, std::string fingerprint, std::string uid)
+            : self(kj::mv(self)), server(server), fingerprint(std::move(fingerprint)), uid(std::move(uid)),
+              loggedUid(std::make_shared<const std::string>(this->uid)) {}
+
+    DispatchCallResult dispatchCall(uint64_t interfaceId, uint16_t methodId,
+                                    capnp::CallContext<capnp::AnyPointer, capnp::AnyPointer> context) override {
+        auto dispatch = [this, interfaceId, methodId, context] {
+            return Session::Server::dispatchCall(interfaceId, methodId, context);
+        };
+        return RpcMetrics<Session>::get().wrap(methodId, server.admit(server.sessionRoutes, methodId, kj::mv(dispatch)),
+                                               loggedUid);
+    }
+
+    kj::Promise<void> logout(LogoutContext cxt) override {
+        check();
+        active = false;
+        return server.endSession(fingerprint, uid);
+    }
+
+    kj::Promise<void> upload(UploadContext cxt) override {
+        check();
+        return server.handleUpload(cxt, uid);
+    }
+
+    kj::Promise<void> uploadStream(UploadStreamContext cxt) override {
+        check();
+        return server.handleUploadStream(cxt, uid);
+    }
+
+    kj::Promise<void> uploadDelta(UploadDeltaContext cxt) override {
+        check();
+        return server.handleUploadDelta(cxt, uid);
+    }
+
+    kj::Promise<void> download(DownloadContext cxt) override {
+        check();
+        return server.handleDownload(cxt, uid);
+    }
+
+    kj::Promise<void> exportCourse(ExportCourseContext cxt) override {
+        check();
+        return server.handleExportCourse(cxt, uid);
+    }
+
+    kj::Promise<void> remove(RemoveContext cxt) override {
+        check();
+        return server.handleRemove(cxt, uid);
+    }
+
+    kj::Promise<void> listProject(ListProjectContext cxt) override {
+        check();
+        return server.handleListProject(cxt, uid);
+    }
+
+    kj::Promise<void> listAll(ListAllContext cxt) override {
+        check();
+        return server.handleListAll(cxt, uid);
+    }
+
+    kj::Promise<void> addStudent(AddStudentContext cxt) override {
+        check();
+        return server.handleAddStudent(cxt, uid);
+    }
+
+    kj::Promise<void> removeStudent(RemoveStudentContext cxt) override {
+        check();
+        return server.handleRemoveStudent(cxt, uid);
+    }
+
+    kj::Promise<void> enrollStudents(EnrollStudentsContext cxt) override {
+        check();
+        return server.handleEnrollStudents(cxt, uid);
+    }
+
+    kj::Promise<void> unenrollStudents(UnenrollStudentsContext cxt) override {
+        check();
+        return server.handleUnenrollStudents(cxt, uid);
+    }
+
+    kj::Promise<void> judge(JudgeContext cxt) override {
+        check();
+        return server.handleJudge(cxt, uid);
+    }
+
+    kj::Promise<void> judgeMany(JudgeManyContext cxt) override {
+        check();
+        return server.handleJudgeMany(cxt, uid);
+    }
+
+    kj::Promise<void> newCourse(NewCourseContext cxt) override {
+        check();
+        return server.handleNewCourse(cxt, uid);
+    }
+
+    kj::Promise<void> deleteCourse(DeleteCourseContext cxt) override {
+        check();
+        return server.handleDeleteCourse(cxt, uid);
+    }
+};
+
+Session::Client SystemServerImpl::newSession(const std::string &fingerprint, const std::string &uid) {
+    return kj::heap<SessionImpl>(thisCap(), *this, fingerprint, uid);
+}
+
+// Opens a listening socket with SO_REUSEPORT set, so that every event-loop thread can bind its own
+// socket to the same port and let the kernel spread incoming connections between them.
+int listenReusePort(uint16_t port) {
+    int one = 1, zero = 0;
+    int fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        sockaddr_in6 addr{};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            return fd;
+        }
+        ::close(fd);
+    }
+    fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("cannot create listening socket");
+    }
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        ::close(fd);
+        throw std::runtime_error("cannot listen on port " + std::to_string(port));
+    }
+    return fd;
+}
+
+// Gives an event-loop thread its handle on the storage backend.
+using OpenStorage = std::function<kj::Own<Storage>(kj::Network &)>;
+
+// Accounts for the memory backend, one "uid password [teacher]" per line; the password is hashed
+// here as the accounts table stores it.
+bool loadAccounts(MemoryStorage &storage, const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    while (!file.atEnd()) {
+        auto fields = QString::fromUtf8(file.readLine()).simplified().split(' ', Qt::SkipEmptyParts);
+        if (fields.size() < 2) {
+            continue;
+        }
+        storage.addAccount(fields[0].toStdString(), CalcSHA256(fields[1].toStdString())(),
+                           fields.size() > 2 && fields[2] == "teacher");
+    }
+    return true;
+}
+
+// One front-end thread: its own event loop, listening socket, storage handle and SystemServerImpl.
+// The key, database, extraction and export pools, the listing cache and admission control are shared
+// between all of them.
+void serve(int fd, const OpenStorage &openStorage, Extractor &extractor, Exporter &exporter, KeyPool &keys,
+           const TicketIssuer &tickets, ListingCache &listings, Admission &admission) {
+    try {
+        auto io = kj::setupAsyncIo();
+        auto listener = io.lowLevelProvider->wrapListenSocketFd(fd, kj::LowLevelAsyncIoProvider::TAKE_OWNERSHIP);
+        auto storage = openStorage(io.provider->getNetwork());
+        capnp::TwoPartyServer server(kj::heap<SystemServerImpl>(*storage, extractor, exporter, keys, tickets,
+                                                                listings, admission));
+        server.listen(*listener).wait(io.waitScope);
+    } catch (const kj::Exception &e) {
+        std::cerr << "event loop thread failed: " << e.getDescription().cStr() << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << "event loop thread failed: " << e.what() << std::endl;
+    }
+}
+
 int main(int argc, char *argv[]) {
     QCoreApplication a(argc, argv);
-    capnp::EzRpcServer server(kj::heap<SystemServerImpl>("localhost", 5433, "serverDB", "postgres", "114514",
-                                                         redis::Redis("tcp://127.0.0.1:6377")), "*:10100");
-    ::kj::_::Debug::setLogLevel(kj::LogSeverity::INFO);
-    auto &scope = server.getWaitScope();
-    unsigned int port = server.getPort().wait(scope);
-    if (!port) {
-        std::cout << "Listening on UNIX socket..." << std::endl;
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+            {"port", "Port to listen on.", "port", "10100"},
+            {"threads", "Number of RPC event-loop threads.", "n", "1"},
+            {"key-pool-low", "Refill the RSA key pool once it holds this many pairs.", "n", "8"},
+            {"key-pool-high", "Stop refilling the RSA key pool at this many pairs.", "n", "64"},
+            {"key-pool-workers", "Number of RSA key generation threads.", "n", "2"},
+            {"storage", "Where accounts, projects and sessions live: \"postgres\" (with Redis) or \"memory\".",
+             "backend", "postgres"},
+            {"accounts", "Accounts to create in the memory backend, one \"uid password [teacher]\" per line.",
+             "file"},
+            {"db-workers", "Number of database threads, each with its own connection.", "n", "4"},
+            {"extract-workers", "Number of threads extracting uploaded archives.", "n",
+             QString::number(std::max(1u, std::thread::hardware_concurrency()))},
+            {"ticket-key", "File holding the secret that signs resumption tickets; random per run if unset.",
+             "file"},
+            {"ticket-ttl", "Seconds a resumption ticket stays valid.", "s", "604800"},
+            {"export-workers", "Number of threads mapping files for downloads.", "n", "2"},
+            {"blob-store", "Directory holding deduplicated file contents; must share a filesystem with the "
+                           "user trees.", "dir", "blobs"},
+            {"listing-cache", "Bytes of encoded project listings to cache; 0 disables the cache.", "bytes",
+             "67108864"},
+            {"access-log", "File to append one line per RPC to; \"-\" for stderr, empty to disable.", "file", "-"},
+            {"verbose", "Also print informational log messages."},
+            {"admit-keys", "Concurrent and queued initiateSession/login calls; more are refused.", "n:queue",
+             "8:64"},
+            {"admit-upload", "Concurrent and queued uploads being stored; more are refused.", "n:queue", "4:32"},
+            {"admit-export", "Concurrent and queued downloads and exports; more are refused.", "n:queue", "4:32"},
+    });
+    parser.process(a);
+    if (parser.isSet("verbose")) {
+        ::kj::_::Debug::setLogLevel(kj::LogSeverity::INFO);
+    }
+    std::unique_ptr<AccessLog> accessLog;
+    if (QString path = parser.value("access-log"); !path.isEmpty()) {
+        FILE *out = path == "-" ? stderr : std::fopen(QFile::encodeName(path).constData(), "a");
+        if (!out) {
+            std::cerr << "cannot open access log" << std::endl;
+            return 1;
+        }
+        accessLog = std::make_unique<AccessLog>(out);
+    }
+    KeyPool keys(QRSAEncryption::Rsa::RSA_2048, parser.value("key-pool-low").toUInt(),
+                 parser.value("key-pool-high").toUInt(), parser.value("key-pool-workers").toUInt());
+    Metrics::gauge("gdms_key_pool_size", "RSA key pairs ready in the pool.", [&keys] {
+        return keys.stats().size;
+    });
+    std::unique_ptr<DbPool> database;
+    MemoryStorage memory;
+    OpenStorage openStorage;
+    if (parser.value("storage") == "memory") {
+        if (parser.isSet("accounts") && !loadAccounts(memory, parser.value("accounts"))) {
+            std::cerr << "cannot read accounts" << std::endl;
+            return 1;
+        }
+        openStorage = [&memory](kj::Network &) {
+            return kj::Own<Storage>(&memory, kj::NullDisposer::instance);
+        };
+    } else if (parser.value("storage") == "postgres") {
+        database = std::make_unique<DbPool>(DbConfig{"localhost", 5433, "serverDB", "postgres", "114514"},
+                                            parser.value("db-workers").toUInt(), sqlCatalog(),
+                                            [](size_t i, QSqlDatabase &db) {
+                                                if (i == 0) {
+                                                    migrate(db);
+                                                }
+                                            });
+        openStorage = [&database](kj::Network &network) -> kj::Own<Storage> {
+            return kj::heap<PostgresStorage>(*database, network, "127.0.0.1", 6377);
+        };
     } else {
-        std::cout << "Listening on port " << port << std::endl;
+        std::cerr << "unknown storage backend" << std::endl;
+        return 1;
+    }
+    BlobStore blobs(parser.value("blob-store"));
+    Extractor extractor(parser.value("extract-workers").toUInt(), blobs);
+    Exporter exporter(parser.value("export-workers").toUInt());
+    std::string ticketKey;
+    if (parser.isSet("ticket-key")) {
+        QFile file(parser.value("ticket-key"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::cerr << "cannot read ticket key" << std::endl;
+            return 1;
+        }
+        ticketKey = file.readAll().toStdString();
+    }
+    TicketIssuer tickets(ticketKey, std::chrono::seconds(parser.value("ticket-ttl").toUInt()));
+    ListingCache listings(parser.value("listing-cache").toULongLong());
+    Metrics::gauge("gdms_listing_cache_bytes", "Encoded size of the cached project listings.", [&listings] {
+        return listings.size();
+    });
+    auto limit = [&parser](const QString &option) {
+        auto parts = parser.value(option).split(':');
+        return Admission::Limit{std::max(1u, parts[0].toUInt()), parts.size() > 1 ? parts[1].toUInt() : 0};
+    };
+    Admission admission({{"keys", limit("admit-keys")},
+                         {"upload", limit("admit-upload")},
+                         {"export", limit("admit-export")}});
+    auto port = static_cast<uint16_t>(parser.value("port").toUInt());
+    unsigned threads = std::max(1u, parser.value("threads").toUInt());
+    std::vector<std::thread> loops;
+    for (unsigned i = 0; i != threads; ++i) {
+        loops.emplace_back(serve, listenReusePort(port), std::cref(openStorage), std::ref(extractor),
+                           std::ref(exporter), std::ref(keys), std::cref(tickets), std::ref(listings), std::ref(admission));
+    }
+    std::cout << "Listening on port " << port << " with " << threads << " event loop(s)" << std::endl;
+    for (auto &t: loops) {
+        t.join();
     }
-    kj::NEVER_DONE.wait(scope);
     return 0;
 }